@@ -17,6 +17,9 @@ Compling and execute process
 - % ./capture_sample
 - If COM port is not found, then change the com_port in main function.
 
+Offline conversion of a session recorded with RAW_OUTPUT
+- % UST-10LX-C convert raw_output.txt data.csv [csv|xy|bin] [threads]
+
 \attention Change com_port, com_baudrate values in main() with relevant values.
 \attention We are not responsible for any loss or damage occur by using this program
 \attention We appreciate the suggestions and bug reports
@@ -30,6 +33,9 @@ Compling and execute process
 #include <cstdlib>
 #include <cstring>
 #include <string>
+#include "urg_scan.h"
+#include "urg_convert.h"
+#include "urg_echo.h"
 
 using namespace std;
 
@@ -53,37 +59,6 @@ static int ReadableSize = 0;
 static char* ErrorMessage = "no error.";
 
 
-/*!
-\brief Manage sensor information
-*/
-typedef struct
-{
-	enum {
-		MODL = 0,                   //!< Sensor model information              0
-		DMIN,                       //!< Minimum measurable distance [mm]      1
-		DMAX,                       //!< Maximum measurable distance [mm]      2
-		ARES,                       //!< Angle of resolution                   3
-		AMIN,                       //!< Minimum measurable area               4
-		AMAX,                       //!< Maximum measurable area               5
-		AFRT,                       //!< Front direction value                 6
-		SCAN,                       //!< Standard angular velocity             7
-	};
-	string model;                 //!< Obtained MODL information
-	long distance_min;            //!< Obtained DMIN information
-	long distance_max;            //!< Obtained DMAX information
-	int area_total;               //!< Obtained ARES information
-	int area_min;                 //!< Obtained AMIN information
-	int area_max;                 //!< Obtained AMAX information
-	int area_front;               //!< Obtained AFRT information
-	int scan_rpm;                 //!< Obtained SCAN information                  
-
-	int first;                    //!< Starting position of measurement         ʼλ
-	int last;                     //!< End position of measurement              λ
-	int max_size;                 //!< Maximum size of data                     󳤶
-	long last_timestamp;          //!< Time stamp when latest data is obtained  ݵʱ
-} urg_state_t;
-
-
 // Delay
 static void delay(int msec)
 {
@@ -469,16 +444,44 @@ static int urg_captureByMD(const urg_state_t* state, int capture_times)
 }
 
 
-// Decode 6bit data
-static long urg_decode(const char data[], int data_byte)
+/*!
+\brief Receive multi-echo range data by using HD command
+
+\param state[i] Sensor information
+
+\retval 0 Success
+\retval < 0 Error
+*/
+static int urg_captureByHD(const urg_state_t* state)
+{
+	char send_message[LineLength];
+	_snprintf(send_message, LineLength,
+		"HD%04d%04d%02d", state->first, state->last, 1);
+	return urg_sendTag(send_message);
+}
+
+
+/*!
+\brief Get multi-echo range data by using ND command
+
+\param state [i] Sensor information
+\param capture_times [i] capture times
+
+\retval 0 Success
+\retval < 0 Error
+*/
+static int urg_captureByND(const urg_state_t* state, int capture_times)
 {
-	long value = 0;
-	for (int i = 0; i < data_byte; ++i) {
-		value <<= 6;
-		value &= ~0x3f;
-		value |= data[i] - 0x30;   //ƴ
+	// As MD, 100 or more times means infinite, stopped by QT
+	if (capture_times >= 100) {
+		capture_times = 0;
 	}
-	return value;
+
+	char send_message[LineLength];
+	_snprintf(send_message, LineLength, "ND%04d%04d%02d%01d%02d",
+		state->first, state->last, 1, 0, capture_times);
+
+	return urg_sendTag(send_message);
 }
 
 
@@ -520,20 +523,6 @@ static int urg_addRecvData(const char buffer[], long data[], int* filled)
 }
 
 
-static int checkSum(char buffer[], int size, char actual_sum)
-{
-	char expected_sum = 0x00;
-	int i;
-
-	for (i = 0; i < size; ++i) {
-		expected_sum += buffer[i];
-	}
-	expected_sum = (expected_sum & 0x3f) + 0x30;
-
-	return (expected_sum == actual_sum) ? 0 : -1;
-}
-
-
 /*!
 \brief Receive URG data
 
@@ -623,6 +612,86 @@ static int urg_receiveData(urg_state_t* state, long data[], size_t max_size)
 }
 
 
+/*!
+\brief Receive multi-echo URG data
+
+The scan is taken from arena, which is reset by the caller for each frame.
+
+\param state [i] Sensor information
+\param arena [i/o] Memory for the scan
+\param scan [o] range data
+
+\retval >= 0 number of steps
+\retval < 0 Error
+*/
+static int urg_receiveEchoData(urg_state_t* state, urg_arena_t* arena,
+	urg_echo_scan_t* scan)
+{
+	urg_echo_decoder_t decoder;
+	if (urg_echoDecodeBegin(&decoder, arena, state, state->first, scan) < 0) {
+		return -1;
+	}
+
+	char message_type = 'N';
+	char buffer[LineLength];
+	int line_length;
+	for (int line_count = 0; (line_length = urg_readLine(buffer)) >= 0;
+	++line_count) {
+
+		// check sum
+		if ((line_count > 3) && (line_length >= 3)) {
+			if (checkSum(buffer, line_length - 1, buffer[line_length - 1]) < 0) {
+				fprintf(stderr, "line_count: %d: %s\n", line_count, buffer);
+				return -1;
+			}
+		}
+
+		if ((line_count >= 6) && (line_length == 0)) {
+			// Steps after the end position have no echo
+			return urg_echoDecodeEnd(&decoder);
+
+		}
+		else if (line_count == 0) {
+			if ((buffer[0] != 'N') && (buffer[0] != 'H')) {
+				return -1;
+			}
+			message_type = buffer[0];
+
+		}
+		else if (!strncmp(buffer, "99b", 3)) {
+			line_count = 4;
+
+		}
+		else if ((line_count == 1) && (message_type == 'H')) {
+			line_count = 4;
+
+		}
+		else if (line_count == 4) {
+			if (strncmp(buffer, "99b", 3)) {
+				return -1;
+			}
+
+		}
+		else if (line_count == 5) {
+			state->last_timestamp = urg_decode(buffer, 4);
+			scan->timestamp = state->last_timestamp;
+
+		}
+		else if (line_count >= 6) {
+			// '&' between echoes is a part of the 64 bytes data
+			if (line_length > (64 + 1)) {
+				line_length = (64 + 1);
+			}
+			int ret = urg_echoDecodeLine(&decoder, buffer, line_length - 1);
+			if (ret < 0) {
+				return ret;
+			}
+		}
+	}
+	return -1;
+}
+
+
 void outputData(long data[], int n, size_t total_index)
 {
 	char output_file[] = "data_xxxxxxxxxx.csv";
@@ -644,6 +713,11 @@ void outputData(long data[], int n, size_t total_index)
 
 int main(int argc, char *argv[])                                                      //**********   main   ****************
 {
+	// Convert a recording made with RAW_OUTPUT instead of capturing
+	if ((argc >= 2) && !strcmp(argv[1], "convert")) {
+		return urg_convertMain(argc - 1, &argv[1]);
+	}
+
 	// COM |[gݒ
 	// ҪʵĴں
 	const char com_port[] = "COM3";
@@ -711,6 +785,29 @@ int main(int argc, char *argv[])
 		urg_sendMessage("QT", Timeout, &dummy);                             //QTָл״Ĺ״ֹ̬ͣΪ״̬
 	}
 
+	//////////////////////////////////////////////////////////////////////
+	// Multi-echo data by HD command
+	printf("using HD command\n");
+
+	urg_arena_t arena;
+	urg_arenaInit(&arena, urg_arenaSize(&urg_state, 1));
+	for (int i = 0; i < CaptureTimes; ++i) {
+		// The previous scan is not used any more
+		urg_arenaReset(&arena);
+
+		urg_echo_scan_t scan;
+		urg_captureByHD(&urg_state);
+		int n = urg_receiveEchoData(&urg_state, &arena, &scan);
+		if (n > 0) {
+			int front = urg_state.area_front;
+			printf("% 3d: front: %ld (%d echoes), urg_timestamp: %ld\n",
+				i, (scan.offsets[front] < scan.offsets[front + 1]) ?
+				scan.echoes[scan.offsets[front]] : -1,
+				scan.offsets[front + 1] - scan.offsets[front], scan.timestamp);
+		}
+	}
+	printf("\n");
+
 	urg_disconnect();
 	delete[] data;
 
@@ -0,0 +1,223 @@
+/*!
+\file
+\brief Work-stealing thread pool
+*/
+
+#include "stdafx.h"
+
+#include "thread_pool.h"
+
+
+namespace
+{
+	// Pool and worker index of the current thread, to queue nested tasks
+	// to the worker itself
+	thread_local const void* CurrentPool = nullptr;
+	thread_local int CurrentWorker = -1;
+}
+
+
+ThreadPool::ThreadPool(int threads)
+	: queued_(0), pending_(0), next_(0), jobs_(nullptr), stop_(false)
+{
+	if (threads <= 0) {
+		threads = (int)std::thread::hardware_concurrency();
+		if (threads <= 0) {
+			threads = 1;
+		}
+	}
+
+	for (int i = 0; i < threads; ++i) {
+		workers_.push_back(std::unique_ptr<Worker>(new Worker));
+	}
+	for (int i = 0; i < threads; ++i) {
+		threads_.push_back(std::thread(&ThreadPool::run, this, i));
+	}
+}
+
+
+ThreadPool::~ThreadPool()
+{
+	wait();
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		stop_ = true;
+	}
+	wake_.notify_all();
+	for (size_t i = 0; i < threads_.size(); ++i) {
+		threads_[i].join();
+	}
+}
+
+
+int ThreadPool::size() const
+{
+	return (int)workers_.size();
+}
+
+
+void ThreadPool::submit(std::function<void()> task)
+{
+	int index;
+	if ((CurrentPool == this) && (CurrentWorker >= 0)) {
+		index = CurrentWorker;
+	}
+	else {
+		index = (int)(next_++ % workers_.size());
+	}
+
+	++pending_;
+	{
+		std::lock_guard<std::mutex> lock(workers_[index]->mutex);
+		workers_[index]->tasks.push_back(std::move(task));
+	}
+	{
+		// Take the lock so that a worker going to sleep does not miss this
+		std::lock_guard<std::mutex> lock(mutex_);
+		++queued_;
+	}
+	wake_.notify_one();
+}
+
+
+void ThreadPool::wait()
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+	idle_.wait(lock, [this] { return pending_ == 0; });
+}
+
+
+void ThreadPool::parallelRun(int count, void (*call)(const void*, int),
+	const void* task)
+{
+	if (count <= 0) {
+		return;
+	}
+
+	ParallelJob job;
+	job.call = call;
+	job.task = task;
+	job.count = count;
+	job.next = 0;
+	job.helpers = 0;
+	job.link = nullptr;
+
+	bool is_shared = (count > 1) && !workers_.empty();
+	if (is_shared) {
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			job.link = jobs_;
+			jobs_ = &job;
+		}
+		wake_.notify_all();
+	}
+	runJob(job);
+	if (!is_shared) {
+		return;
+	}
+
+	// All indices are taken. No worker joins after the job is unlinked, and
+	// the job must live until the workers in it have left
+	std::unique_lock<std::mutex> lock(mutex_);
+	for (ParallelJob** p = &jobs_; *p; p = &(*p)->link) {
+		if (*p == &job) {
+			*p = job.link;
+			break;
+		}
+	}
+	helped_.wait(lock, [&job] { return job.helpers == 0; });
+}
+
+
+void ThreadPool::runJob(ParallelJob& job)
+{
+	int i;
+	while ((i = job.next++) < job.count) {
+		job.call(job.task, i);
+	}
+}
+
+
+ThreadPool::ParallelJob* ThreadPool::findJob() const
+{
+	// Called with mutex_ locked
+	for (ParallelJob* job = jobs_; job; job = job->link) {
+		if (job->next < job->count) {
+			return job;
+		}
+	}
+	return nullptr;
+}
+
+
+bool ThreadPool::popTask(int index, std::function<void()>& task)
+{
+	// Newest task of the own queue, which is likely still in the cache
+	{
+		Worker& worker = *workers_[index];
+		std::lock_guard<std::mutex> lock(worker.mutex);
+		if (!worker.tasks.empty()) {
+			task = std::move(worker.tasks.back());
+			worker.tasks.pop_back();
+			--queued_;
+			return true;
+		}
+	}
+
+	// Steal the oldest task of the other workers
+	int n = (int)workers_.size();
+	for (int i = 1; i < n; ++i) {
+		Worker& victim = *workers_[(index + i) % n];
+		std::lock_guard<std::mutex> lock(victim.mutex);
+		if (!victim.tasks.empty()) {
+			task = std::move(victim.tasks.front());
+			victim.tasks.pop_front();
+			--queued_;
+			return true;
+		}
+	}
+	return false;
+}
+
+
+void ThreadPool::run(int index)
+{
+	CurrentPool = this;
+	CurrentWorker = index;
+
+	while (true) {
+		// A parallelFor() caller is waiting, so its loop goes first
+		ParallelJob* job = nullptr;
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			job = findJob();
+			if (job) {
+				++job->helpers;
+			}
+		}
+		if (job) {
+			runJob(*job);
+			std::lock_guard<std::mutex> lock(mutex_);
+			if (--job->helpers == 0) {
+				helped_.notify_all();
+			}
+			continue;
+		}
+
+		std::function<void()> task;
+		if (popTask(index, task)) {
+			task();
+			if (--pending_ == 0) {
+				std::lock_guard<std::mutex> lock(mutex_);
+				idle_.notify_all();
+			}
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(mutex_);
+		wake_.wait(lock, [this] { return stop_ || (queued_ > 0) || findJob(); });
+		if (stop_ && (queued_ == 0)) {
+			return;
+		}
+	}
+}
@@ -0,0 +1,108 @@
+/*!
+\file
+\brief Work-stealing thread pool
+
+Each worker owns a task queue. A worker takes the newest task of its own
+queue, and when the queue is empty it steals the oldest task of the other
+workers, so that uneven tasks are balanced without a single shared queue.
+
+parallelFor() does not go through the queues: the loop is described on the
+stack of the caller and the idle workers join it, so that it does not
+allocate memory.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+class ThreadPool
+{
+public:
+	/*!
+	\brief Start worker threads
+
+	\param threads [i] number of workers. If <= 0, the number of CPU cores
+	*/
+	explicit ThreadPool(int threads = 0);
+	~ThreadPool();
+
+	//! Number of worker threads
+	int size() const;
+
+	/*!
+	\brief Add a task
+
+	A task added from a worker is queued to the worker itself.
+	*/
+	void submit(std::function<void()> task);
+
+	//! Wait until all submitted tasks are finished
+	void wait();
+
+	/*!
+	\brief Call task(0) ... task(count - 1) in parallel and wait for them
+
+	The calling thread runs tasks too, so this may be used from a worker.
+	task is referenced, not copied, and must be callable from several
+	threads at once.
+	*/
+	template <typename Task>
+	void parallelFor(int count, const Task& task)
+	{
+		parallelRun(count, &callTask<Task>, &task);
+	}
+
+private:
+	ThreadPool(const ThreadPool&);
+	ThreadPool& operator=(const ThreadPool&);
+
+	//! Loop of parallelFor(), on the stack of the caller
+	struct ParallelJob
+	{
+		void (*call)(const void* task, int index);
+		const void* task;
+		int count;
+		std::atomic<int> next;        //!< Next index to run
+		int helpers;                  //!< Workers in the loop, guarded by mutex_
+		ParallelJob* link;            //!< Next job in jobs_
+	};
+
+	template <typename Task>
+	static void callTask(const void* task, int index)
+	{
+		(*static_cast<const Task*>(task))(index);
+	}
+
+	void parallelRun(int count, void (*call)(const void*, int), const void* task);
+	static void runJob(ParallelJob& job);
+	ParallelJob* findJob() const;
+
+	struct Worker
+	{
+		std::mutex mutex;
+		std::deque<std::function<void()> > tasks;
+	};
+
+	void run(int index);
+	bool popTask(int index, std::function<void()>& task);
+
+	std::vector<std::unique_ptr<Worker> > workers_;
+	std::vector<std::thread> threads_;
+	std::mutex mutex_;
+	std::condition_variable wake_;
+	std::condition_variable idle_;
+	std::atomic<int> queued_;
+	std::atomic<int> pending_;
+	std::atomic<unsigned int> next_;
+	ParallelJob* jobs_;
+	std::condition_variable helped_;
+	bool stop_;
+};
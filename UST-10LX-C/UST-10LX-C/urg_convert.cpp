@@ -0,0 +1,494 @@
+/*!
+\file
+\brief Offline conversion of recorded SCIP sessions
+*/
+
+#include "stdafx.h"
+
+#include "urg_convert.h"
+#include "urg_scan.h"
+#include "urg_echo.h"
+#include "thread_pool.h"
+#include <windows.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+
+namespace
+{
+	// Size of the part of the recording converted by one task. Fixed, so
+	// that the converted data held in memory does not grow with the file
+	const size_t ChunkSize = 4 << 20;
+
+	// A response longer than this is broken, and ends a chunk where it is
+	const size_t ChunkMargin = ChunkSize / 4;
+}
+
+
+/*!
+\brief File mapping. Parts of the file are mapped by mapView()
+*/
+typedef struct
+{
+	HANDLE file;
+	HANDLE mapping;
+	unsigned long long size;
+	unsigned long granularity;    //!< Alignment of the view offset
+} mapped_file_t;
+
+
+/*!
+\brief Mapped part of the file
+*/
+typedef struct
+{
+	const void* base;             //!< Start of the view, for UnmapViewOfFile()
+	const char* data;             //!< Requested offset
+	const char* end;
+} file_view_t;
+
+
+/*!
+\brief Part of the recording converted by one task
+
+The task starts at the end of the first response after offset, and ends
+at the same place for the next chunk, so that the chunks do not overlap.
+*/
+typedef struct
+{
+	unsigned long long offset;    //!< Nominal start in the file
+	unsigned long long size;      //!< Nominal size
+	bool is_first;
+	bool is_last;
+	string output;                //!< Converted data
+	long scans;                   //!< number of converted scans
+	long errors;                  //!< number of broken responses
+	bool is_mapped;               //!< false if the view could not be mapped
+	bool done;
+} convert_chunk_t;
+
+
+static int mapFile(mapped_file_t* mapped, const char* file_name)
+{
+	mapped->mapping = NULL;
+	mapped->size = 0;
+
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	mapped->granularity = info.dwAllocationGranularity;
+
+	mapped->file = CreateFileA(file_name, GENERIC_READ, FILE_SHARE_READ,
+		NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (mapped->file == INVALID_HANDLE_VALUE) {
+		return -1;
+	}
+
+	LARGE_INTEGER file_size;
+	if (!GetFileSizeEx(mapped->file, &file_size)) {
+		CloseHandle(mapped->file);
+		return -1;
+	}
+	mapped->size = (unsigned long long)file_size.QuadPart;
+	if (mapped->size == 0) {
+		// An empty file can not be mapped
+		return 0;
+	}
+
+	mapped->mapping =
+		CreateFileMappingA(mapped->file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mapped->mapping == NULL) {
+		CloseHandle(mapped->file);
+		return -1;
+	}
+	return 0;
+}
+
+
+static void unmapFile(mapped_file_t* mapped)
+{
+	if (mapped->mapping) {
+		CloseHandle(mapped->mapping);
+	}
+	CloseHandle(mapped->file);
+}
+
+
+// Map size bytes from offset, less at the end of the file. Only a part of
+// the file is mapped at once, so that a recording larger than the address
+// space can be converted
+static int mapView(const mapped_file_t* mapped, unsigned long long offset,
+	unsigned long long size, file_view_t* view)
+{
+	if (offset + size > mapped->size) {
+		size = mapped->size - offset;
+	}
+	unsigned long long aligned = offset - (offset % mapped->granularity);
+	size_t view_size = (size_t)(offset - aligned + size);
+	view->base = NULL;
+	view->data = NULL;
+	view->end = NULL;
+	if (view_size == 0) {
+		return 0;
+	}
+
+	view->base = MapViewOfFile(mapped->mapping, FILE_MAP_READ,
+		(DWORD)(aligned >> 32), (DWORD)(aligned & 0xffffffff), view_size);
+	if (view->base == NULL) {
+		return -1;
+	}
+	view->data = static_cast<const char*>(view->base) + (offset - aligned);
+	view->end = view->data + size;
+	return 0;
+}
+
+
+static void unmapView(file_view_t* view)
+{
+	if (view->base) {
+		UnmapViewOfFile(view->base);
+	}
+}
+
+
+// End of the first response after p, looking at ChunkMargin bytes at most.
+// Depends only on the bytes from p, so two chunks find the same place
+static const char* chunkBoundary(const char* p, const char* end)
+{
+	if ((size_t)(end - p) > ChunkMargin) {
+		end = p + ChunkMargin;
+	}
+	// Go to the start of the next line, then to the end of the response
+	const char* q = static_cast<const char*>(memchr(p, '\n', end - p));
+	if (!q) {
+		return end;
+	}
+	return urg_nextFrame(q + 1, end);
+}
+
+
+static void appendScan(string& output, const urg_state_t* state,
+	const urg_directions_t* directions, urg_convert_format_t format,
+	const urg_scan_t* scan)
+{
+	const vector<long>& data = scan->data;
+	int n = (int)data.size();
+	char buffer[64];
+
+	if (format == URG_CONVERT_CSV) {
+		for (int i = 0; i < n; ++i) {
+			int length = _snprintf(buffer, sizeof(buffer), "%ld, ", data[i]);
+			output.append(buffer, length);
+		}
+		output += '\n';
+
+	}
+	else if (format == URG_CONVERT_XY) {
+		if (n > state->max_size) {
+			n = state->max_size;
+		}
+		for (int i = 0; i < n; ++i) {
+			long distance = data[i];
+			if ((distance < state->distance_min) ||
+				(distance > state->distance_max)) {
+				continue;
+			}
+			int length = _snprintf(buffer, sizeof(buffer), "%ld, %.0f, %.0f\n",
+				scan->timestamp,
+				distance * directions->cos_table[i],
+				distance * directions->sin_table[i]);
+			output.append(buffer, length);
+		}
+
+	}
+	else {
+		int header[2];
+		header[0] = (int)scan->timestamp;
+		header[1] = n;
+		output.append(reinterpret_cast<const char*>(header), sizeof(header));
+		for (int i = 0; i < n; ++i) {
+			int value = (int)data[i];
+			output.append(reinterpret_cast<const char*>(&value), sizeof(value));
+		}
+	}
+}
+
+
+static void appendEchoScan(string& output, const urg_state_t* state,
+	const urg_directions_t* directions, urg_convert_format_t format,
+	const urg_echo_scan_t* scan)
+{
+	const int* offsets = scan->offsets;
+	const long* echoes = scan->echoes;
+	int n = scan->steps;
+	char buffer[64];
+
+	if (format == URG_CONVERT_CSV) {
+		// Echoes of a step are joined by '&', as in the response
+		for (int i = 0; i < n; ++i) {
+			if (offsets[i] == offsets[i + 1]) {
+				output += "-1, ";
+				continue;
+			}
+			for (int j = offsets[i]; j < offsets[i + 1]; ++j) {
+				int length = _snprintf(buffer, sizeof(buffer),
+					(j + 1 < offsets[i + 1]) ? "%ld&" : "%ld, ", echoes[j]);
+				output.append(buffer, length);
+			}
+		}
+		output += '\n';
+
+	}
+	else if (format == URG_CONVERT_XY) {
+		if (n > state->max_size) {
+			n = state->max_size;
+		}
+		for (int i = 0; i < n; ++i) {
+			for (int j = offsets[i]; j < offsets[i + 1]; ++j) {
+				long distance = echoes[j];
+				if ((distance < state->distance_min) ||
+					(distance > state->distance_max)) {
+					continue;
+				}
+				int length = _snprintf(buffer, sizeof(buffer), "%ld, %.0f, %.0f\n",
+					scan->timestamp,
+					distance * directions->cos_table[i],
+					distance * directions->sin_table[i]);
+				output.append(buffer, length);
+			}
+		}
+
+	}
+	else {
+		// Negative number of steps tells a multi-echo scan
+		int header[2];
+		header[0] = (int)scan->timestamp;
+		header[1] = -n;
+		output.append(reinterpret_cast<const char*>(header), sizeof(header));
+		for (int i = 0; i < n; ++i) {
+			int count = offsets[i + 1] - offsets[i];
+			output.append(reinterpret_cast<const char*>(&count), sizeof(count));
+		}
+		for (int j = 0; j < scan->echo_count; ++j) {
+			int value = (int)echoes[j];
+			output.append(reinterpret_cast<const char*>(&value), sizeof(value));
+		}
+	}
+}
+
+
+static void convertChunk(convert_chunk_t* chunk, const mapped_file_t* mapped,
+	const urg_state_t* state, const urg_directions_t* directions,
+	urg_convert_format_t format)
+{
+	// The view covers the response running over the nominal end
+	file_view_t view;
+	if (mapView(mapped, chunk->offset, chunk->size + ChunkMargin, &view) < 0) {
+		chunk->is_mapped = false;
+		return;
+	}
+	if (!view.data) {
+		return;
+	}
+	const char* first = chunk->is_first ? view.data : chunkBoundary(view.data, view.end);
+	const char* last = view.end;
+	if (!chunk->is_last) {
+		last = chunkBoundary(view.data + chunk->size, view.end);
+	}
+
+	urg_scan_t scan;
+	urg_echo_scan_t echo_scan;
+	urg_arena_t arena;
+	urg_arenaInit(&arena, (state->max_size > 0) ? urg_arenaSize(state, 1) : 0);
+
+	const char* p = first;
+	while (p < last) {
+		const char* next = urg_nextFrame(p, last);
+		int n = urg_decodeFrame(state, p, next - p, &scan);
+		bool is_echo = false;
+		if (n == 0) {
+			// HD / ND response. The arena holds one scan at a time
+			urg_arenaReset(&arena);
+			n = urg_decodeEchoFrame(state, p, next - p, &arena, &echo_scan);
+			is_echo = true;
+		}
+		p = next;
+		if (n < 0) {
+			++chunk->errors;
+			continue;
+		}
+		if (n == 0) {
+			continue;
+		}
+		if (is_echo) {
+			appendEchoScan(chunk->output, state, directions, format, &echo_scan);
+		}
+		else {
+			appendScan(chunk->output, state, directions, format, &scan);
+		}
+		++chunk->scans;
+	}
+	unmapView(&view);
+}
+
+
+long urg_convertRecording(const char* input_file, const char* output_file,
+	urg_convert_format_t format, int threads)
+{
+	mapped_file_t mapped;
+	if (mapFile(&mapped, input_file) < 0) {
+		fprintf(stderr, "Cannot open recording: %s\n", input_file);
+		return -1;
+	}
+
+	// The PP response is recorded by urg_connect() before any range data
+	urg_state_t state = urg_state_t();
+	file_view_t head;
+	if (mapView(&mapped, 0, ChunkSize, &head) < 0) {
+		fprintf(stderr, "Cannot map recording: %s\n", input_file);
+		unmapFile(&mapped);
+		return -1;
+	}
+	for (const char* p = head.data, *end = head.end; p < end;) {
+		if (((end - p) >= 2) && (p[1] == 'D') &&
+			((p[0] == 'G') || (p[0] == 'M') || (p[0] == 'H') || (p[0] == 'N'))) {
+			break;
+		}
+		const char* next = urg_nextFrame(p, end);
+		if (urg_parseParameters(&state, p, next - p) == 0) {
+			break;
+		}
+		p = next;
+	}
+	unmapView(&head);
+	if ((format == URG_CONVERT_XY) && (state.max_size <= 0)) {
+		fprintf(stderr, "No PP response in recording: %s\n", input_file);
+		unmapFile(&mapped);
+		return -1;
+	}
+	urg_directions_t directions;
+	if (format == URG_CONVERT_XY) {
+		urg_makeDirections(&state, &directions);
+	}
+
+	FILE* fd = fopen(output_file, (format == URG_CONVERT_BINARY) ? "wb" : "w");
+	if (!fd) {
+		perror("fopen");
+		unmapFile(&mapped);
+		return -1;
+	}
+
+	ThreadPool pool(threads);
+
+	// Chunks of ChunkSize, each task finds its response boundaries. A long
+	// recording gives many chunks, which are balanced by stealing
+	size_t n = (size_t)((mapped.size + ChunkSize - 1) / ChunkSize);
+	vector<convert_chunk_t> chunks(n);
+	for (size_t i = 0; i < n; ++i) {
+		chunks[i].offset = (unsigned long long)i * ChunkSize;
+		chunks[i].size = ChunkSize;
+		chunks[i].is_first = (i == 0);
+		chunks[i].is_last = (i + 1 == n);
+		chunks[i].scans = 0;
+		chunks[i].errors = 0;
+		chunks[i].is_mapped = true;
+		chunks[i].done = false;
+	}
+
+	mutex done_mutex;
+	condition_variable done_condition;
+	size_t submitted = 0;
+	auto submit = [&](size_t i) {
+		pool.submit([&, i] {
+			convertChunk(&chunks[i], &mapped, &state, &directions, format);
+			{
+				lock_guard<mutex> lock(done_mutex);
+				chunks[i].done = true;
+			}
+			done_condition.notify_all();
+		});
+	};
+
+	// Keep a limited number of chunks in flight, so that the converted
+	// data does not pile up when writing is slower than converting
+	size_t window = pool.size() * 2;
+	for (; (submitted < n) && (submitted < window); ++submitted) {
+		submit(submitted);
+	}
+
+	long total_scans = 0;
+	long total_errors = 0;
+	bool is_mapped = true;
+	for (size_t i = 0; i < n; ++i) {
+		{
+			unique_lock<mutex> lock(done_mutex);
+			done_condition.wait(lock, [&] { return chunks[i].done; });
+		}
+		if (!chunks[i].is_mapped) {
+			is_mapped = false;
+			break;
+		}
+		if (submitted < n) {
+			submit(submitted++);
+		}
+
+		fwrite(chunks[i].output.data(), 1, chunks[i].output.size(), fd);
+		string().swap(chunks[i].output);
+		total_scans += chunks[i].scans;
+		total_errors += chunks[i].errors;
+	}
+	pool.wait();
+
+	fclose(fd);
+	unmapFile(&mapped);
+
+	if (!is_mapped) {
+		fprintf(stderr, "Cannot map recording: %s\n", input_file);
+		return -1;
+	}
+	if (total_errors > 0) {
+		fprintf(stderr, "%ld broken responses are skipped.\n", total_errors);
+	}
+	return total_scans;
+}
+
+
+int urg_convertMain(int argc, char* argv[])
+{
+	if (argc < 3) {
+		printf("usage: %s <recording> <output> [csv|xy|bin] [threads]\n",
+			argv[0]);
+		return 1;
+	}
+
+	urg_convert_format_t format = URG_CONVERT_CSV;
+	if (argc >= 4) {
+		if (!strcmp(argv[3], "csv")) {
+			format = URG_CONVERT_CSV;
+		}
+		else if (!strcmp(argv[3], "xy")) {
+			format = URG_CONVERT_XY;
+		}
+		else if (!strcmp(argv[3], "bin")) {
+			format = URG_CONVERT_BINARY;
+		}
+		else {
+			printf("unknown format: %s\n", argv[3]);
+			return 1;
+		}
+	}
+	int threads = (argc >= 5) ? atoi(argv[4]) : 0;
+
+	long n = urg_convertRecording(argv[1], argv[2], format, threads);
+	if (n < 0) {
+		return 1;
+	}
+	printf("%ld scans converted.\n", n);
+	return 0;
+}
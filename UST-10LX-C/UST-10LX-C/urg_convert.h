@@ -0,0 +1,56 @@
+/*!
+\file
+\brief Offline conversion of recorded SCIP sessions
+
+A recording is the raw SCIP stream written when RAW_OUTPUT is defined. It
+is split into chunks of a few MB at response boundaries, each chunk is
+memory mapped and decoded in parallel, and the results are written in
+recorded order. Only the chunks in flight are mapped, so recordings larger
+than the address space can be converted.
+
+Both single echo (GD / MD) and multi-echo (HD / ND) responses are
+converted. The multi-echo responses need the PP response in the
+recording, as the XY format does.
+*/
+
+#pragma once
+
+
+/*!
+\brief Output format of the conversion
+
+In the CSV format the echoes of a step are joined by '&'. In the binary
+format a multi-echo scan has -n in place of n, followed by
+the number of echoes of each of the n steps, then all echoes (int32).
+*/
+typedef enum {
+	URG_CONVERT_CSV = 0,          //!< One line per scan, as outputData()
+	URG_CONVERT_XY,               //!< "timestamp, x, y" per valid step or echo [mm]
+	URG_CONVERT_BINARY,           //!< Per scan: timestamp, n, n range data (int32)
+} urg_convert_format_t;
+
+
+/*!
+\brief Convert a recorded session
+
+\param input_file [i] Recording (raw_output.txt)
+\param output_file [i] Output file
+\param format [i] Output format
+\param threads [i] number of threads. If <= 0, the number of CPU cores
+
+\retval >= 0 number of converted scans
+\retval < 0 Error
+*/
+long urg_convertRecording(const char* input_file, const char* output_file,
+	urg_convert_format_t format, int threads);
+
+
+/*!
+\brief "convert" command line
+
+Usage: convert <recording> <output> [csv|xy|bin] [threads]
+
+\retval 0 Success
+\retval 1 Error
+*/
+int urg_convertMain(int argc, char* argv[]);
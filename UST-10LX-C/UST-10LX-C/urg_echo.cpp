@@ -0,0 +1,198 @@
+/*!
+\file
+\brief Multi-echo range data (HD / ND command)
+*/
+
+#include "stdafx.h"
+
+#include "urg_echo.h"
+#include <cstdlib>
+#include <cstring>
+
+
+namespace
+{
+	const size_t Alignment = 8;
+
+	size_t alignSize(size_t size)
+	{
+		return (size + Alignment - 1) & ~(Alignment - 1);
+	}
+}
+
+
+void urg_arenaInit(urg_arena_t* arena, size_t size)
+{
+	arena->memory.resize(size);
+	arena->used = 0;
+}
+
+
+size_t urg_arenaSize(const urg_state_t* state, int frames)
+{
+	size_t offsets = alignSize(sizeof(int) * (state->max_size + 1));
+	size_t echoes = alignSize(sizeof(long) * state->max_size * UrgMaxEchoes);
+	return (offsets + echoes + Alignment) * frames;
+}
+
+
+void urg_arenaReset(urg_arena_t* arena)
+{
+	arena->used = 0;
+}
+
+
+void* urg_arenaAlloc(urg_arena_t* arena, size_t size)
+{
+	size = alignSize(size);
+	if (arena->memory.empty() || (arena->used + size > arena->memory.size())) {
+		return NULL;
+	}
+	void* p = &arena->memory[arena->used];
+	arena->used += size;
+	return p;
+}
+
+
+int urg_echoDecodeBegin(urg_echo_decoder_t* decoder, urg_arena_t* arena,
+	const urg_state_t* state, int first, urg_echo_scan_t* scan)
+{
+	int max_size = state->max_size;
+	scan->timestamp = 0;
+	scan->steps = 0;
+	scan->echo_count = 0;
+	scan->offsets = static_cast<int*>(urg_arenaAlloc(arena, sizeof(int) * (max_size + 1)));
+	scan->echoes = static_cast<long*>(urg_arenaAlloc(arena, sizeof(long) * max_size * UrgMaxEchoes));
+	if (!scan->offsets || !scan->echoes) {
+		return -1;
+	}
+
+	decoder->arena = arena;
+	decoder->scan = scan;
+	decoder->max_size = max_size;
+	decoder->echo_capacity = max_size * UrgMaxEchoes;
+	decoder->remain_byte = 0;
+	decoder->next_is_echo = 0;
+
+	// No echo before the starting position
+	if (first > max_size) {
+		first = max_size;
+	}
+	for (int i = 0; i < first; ++i) {
+		scan->offsets[i] = 0;
+	}
+	decoder->filled = first;
+
+	return 0;
+}
+
+
+int urg_echoDecodeLine(urg_echo_decoder_t* decoder,
+	const char* line, int length)
+{
+	const int data_byte = 3;
+	urg_echo_scan_t* scan = decoder->scan;
+
+	for (int i = 0; i < length; ++i) {
+		char ch = line[i];
+		if ((ch == '&') && (decoder->remain_byte == 0)) {
+			// The next value is another echo of the same step
+			decoder->next_is_echo = 1;
+			continue;
+		}
+		decoder->remain_data[decoder->remain_byte++] = ch;
+		if (decoder->remain_byte < data_byte) {
+			continue;
+		}
+		decoder->remain_byte = 0;
+
+		if (!decoder->next_is_echo || (decoder->filled == 0)) {
+			if (decoder->filled >= decoder->max_size) {
+				return -1;
+			}
+			scan->offsets[decoder->filled++] = scan->echo_count;
+		}
+		decoder->next_is_echo = 0;
+
+		if (scan->echo_count >= decoder->echo_capacity) {
+			return -1;
+		}
+		scan->echoes[scan->echo_count++] =
+			urg_decode(decoder->remain_data, data_byte);
+	}
+	return 0;
+}
+
+
+int urg_echoDecodeEnd(urg_echo_decoder_t* decoder)
+{
+	urg_echo_scan_t* scan = decoder->scan;
+	for (int i = decoder->filled; i <= decoder->max_size; ++i) {
+		scan->offsets[i] = scan->echo_count;
+	}
+	scan->steps = decoder->max_size;
+
+	// The echoes are the last memory taken, so the unused part is given back
+	urg_arena_t* arena = decoder->arena;
+	const char* echo_end = reinterpret_cast<const char*>(scan->echoes + scan->echo_count);
+	arena->used = alignSize(echo_end - &arena->memory[0]);
+
+	return scan->steps;
+}
+
+
+int urg_decodeEchoFrame(const urg_state_t* state,
+	const char* frame, size_t size, urg_arena_t* arena, urg_echo_scan_t* scan)
+{
+	const char* end = frame + size;
+	const char* line;
+	int line_length;
+
+	// Echo back
+	const char* p = urg_memLine(frame, end, &line, &line_length);
+	if ((line_length < 6) || (line[1] != 'D') ||
+		((line[0] != 'H') && (line[0] != 'N'))) {
+		return 0;
+	}
+	char message_type = line[0];
+	char first_str[5];
+	memcpy(first_str, &line[2], 4);
+	first_str[4] = '\0';
+	int first = atoi(first_str);
+
+	// Status. ND returns "00" as acknowledge and "99" with range data
+	p = urg_memLine(p, end, &line, &line_length);
+	if ((line_length < 2) ||
+		strncmp(line, (message_type == 'H') ? "00" : "99", 2)) {
+		return 0;
+	}
+
+	// Time stamp
+	p = urg_memLine(p, end, &line, &line_length);
+	if (line_length < 5) {
+		return -1;
+	}
+	if (checkSum(line, line_length - 1, line[line_length - 1]) < 0) {
+		return -1;
+	}
+
+	urg_echo_decoder_t decoder;
+	if (urg_echoDecodeBegin(&decoder, arena, state, first, scan) < 0) {
+		return -1;
+	}
+	scan->timestamp = urg_decode(line, 4);
+
+	while (p < end) {
+		p = urg_memLine(p, end, &line, &line_length);
+		if (line_length == 0) {
+			break;
+		}
+		if (checkSum(line, line_length - 1, line[line_length - 1]) < 0) {
+			return -1;
+		}
+		if (urg_echoDecodeLine(&decoder, line, line_length - 1) < 0) {
+			return -1;
+		}
+	}
+	return urg_echoDecodeEnd(&decoder);
+}
@@ -0,0 +1,143 @@
+/*!
+\file
+\brief Multi-echo range data (HD / ND command)
+
+With HD and ND the sensor returns every echo of a step, separated by '&'.
+A scan is stored in compressed rows: the echoes of all steps are in one
+array, and offsets[i] is the first echo of step i.
+
+\code
+// echoes of step i
+for (int j = scan.offsets[i]; j < scan.offsets[i + 1]; ++j) {
+	long distance = scan.echoes[j];
+}
+\endcode
+
+The arrays are taken from an arena which is reset for each frame, so
+decoding does not allocate memory.
+*/
+
+#pragma once
+
+#include "urg_scan.h"
+#include <cstddef>
+#include <vector>
+
+
+/*!
+\brief Memory which is reset at once instead of freed one by one
+*/
+typedef struct
+{
+	std::vector<char> memory;
+	size_t used;
+} urg_arena_t;
+
+
+/*!
+\brief Multi-echo range data of one scan
+*/
+typedef struct
+{
+	long timestamp;               //!< Time stamp of the scan [msec]
+	int steps;                    //!< number of steps
+	int echo_count;               //!< number of echoes of all steps
+	int* offsets;                 //!< First echo of each step, steps + 1 elements
+	long* echoes;                 //!< Range data of all echoes [mm]
+} urg_echo_scan_t;
+
+
+/*!
+\brief State of decoding a multi-echo scan line by line
+*/
+typedef struct
+{
+	urg_arena_t* arena;
+	urg_echo_scan_t* scan;
+	int max_size;                 //!< Maximum number of steps
+	int echo_capacity;            //!< Maximum number of echoes
+	int filled;                   //!< number of started steps
+	char remain_data[3];          //!< Value split between two lines
+	int remain_byte;
+	int next_is_echo;             //!< '&' has been read
+} urg_echo_decoder_t;
+
+
+enum {
+	UrgMaxEchoes = 3,             //!< Maximum echoes of one step
+};
+
+
+//! Allocate the arena
+void urg_arenaInit(urg_arena_t* arena, size_t size);
+
+//! Arena size to hold the given number of scans
+size_t urg_arenaSize(const urg_state_t* state, int frames);
+
+//! Release all memory taken from the arena
+void urg_arenaReset(urg_arena_t* arena);
+
+/*!
+\brief Take memory from the arena
+
+\retval NULL Not enough memory in the arena
+*/
+void* urg_arenaAlloc(urg_arena_t* arena, size_t size);
+
+
+/*!
+\brief Start decoding a scan
+
+\param decoder [o] Decoder
+\param arena [i/o] Arena for the scan
+\param state [i] Sensor information
+\param first [i] Starting position of measurement
+\param scan [o] Scan
+
+\retval 0 Success
+\retval < 0 Not enough memory in the arena
+*/
+int urg_echoDecodeBegin(urg_echo_decoder_t* decoder, urg_arena_t* arena,
+	const urg_state_t* state, int first, urg_echo_scan_t* scan);
+
+
+/*!
+\brief Decode one data line
+
+\param decoder [i/o] Decoder
+\param line [i] Data line without the check sum
+\param length [i] Length of the line
+
+\retval 0 Success
+\retval < 0 Too much data
+*/
+int urg_echoDecodeLine(urg_echo_decoder_t* decoder,
+	const char* line, int length);
+
+
+/*!
+\brief Finish decoding a scan
+
+Steps after the end position have no echo. Unused echo memory is given
+back to the arena.
+
+\retval number of steps
+*/
+int urg_echoDecodeEnd(urg_echo_decoder_t* decoder);
+
+
+/*!
+\brief Decode a recorded HD / ND response
+
+\param state [i] Sensor information
+\param frame [i] HD / ND response
+\param size [i] Size of the response
+\param arena [i/o] Arena for the scan
+\param scan [o] Scan
+
+\retval > 0 number of steps
+\retval 0 frame has no range data (acknowledge or other command)
+\retval < 0 Error
+*/
+int urg_decodeEchoFrame(const urg_state_t* state,
+	const char* frame, size_t size, urg_arena_t* arena, urg_echo_scan_t* scan);
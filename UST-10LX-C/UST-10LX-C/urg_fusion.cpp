@@ -0,0 +1,218 @@
+/*!
+\file
+\brief Fusion of the scans of several sensors into one point cloud
+*/
+
+#include "stdafx.h"
+
+#include "urg_fusion.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+using namespace std;
+
+
+namespace
+{
+	// Range of the 24 bit sensor time stamp
+	const long TimestampRange = 1L << 24;
+}
+
+
+void urg_fusionInit(urg_fusion_t* fusion, ThreadPool* pool)
+{
+	fusion->sensors.clear();
+	fusion->pool = pool;
+}
+
+
+int urg_fusionAddSensor(urg_fusion_t* fusion,
+	const urg_state_t* state, const urg_mount_t* mount)
+{
+	if ((state->max_size <= 0) || (state->area_total <= 0) ||
+		(fusion->sensors.size() > 255)) {
+		return -1;
+	}
+
+	fusion->sensors.push_back(urg_fusion_sensor_t());
+	urg_fusion_sensor_t& sensor = fusion->sensors.back();
+	sensor.state = *state;
+	sensor.mount = *mount;
+	sensor.latest = -1;
+	sensor.last_timestamp = 0;
+	sensor.timestamp_wrap = 0;
+	sensor.offset = 0;
+	sensor.size = 0;
+
+	// Rotate the step directions into the vehicle frame
+	urg_directions_t directions;
+	urg_makeDirections(state, &directions);
+	int n = state->max_size;
+	double c = cos(mount->yaw);
+	double s = sin(mount->yaw);
+	sensor.direction_x.resize(n);
+	sensor.direction_y.resize(n);
+	for (int i = 0; i < n; ++i) {
+		sensor.direction_x[i] = (float)(c * directions.cos_table[i] - s * directions.sin_table[i]);
+		sensor.direction_y[i] = (float)(s * directions.cos_table[i] + c * directions.sin_table[i]);
+	}
+
+	sensor.step_time = (state->scan_rpm > 0) ?
+		60000.0 / ((double)state->scan_rpm * state->area_total) : 0.0;
+	for (int i = 0; i < 2; ++i) {
+		sensor.scans[i].timestamp = 0;
+		sensor.scans[i].data.reserve(n);
+	}
+
+	// Regions of the cloud are assigned in order of registration
+	size_t index = fusion->sensors.size() - 1;
+	if (index > 0) {
+		const urg_fusion_sensor_t& previous = fusion->sensors[index - 1];
+		sensor.offset = previous.offset + previous.state.max_size;
+	}
+	return (int)index;
+}
+
+
+void urg_fusionPrepareCloud(const urg_fusion_t* fusion, urg_cloud_t* cloud)
+{
+	size_t capacity = 0;
+	if (!fusion->sensors.empty()) {
+		const urg_fusion_sensor_t& last = fusion->sensors.back();
+		capacity = last.offset + last.state.max_size;
+	}
+	cloud->x.resize(capacity);
+	cloud->y.resize(capacity);
+	cloud->timestamp.resize(capacity);
+	cloud->sensor.resize(capacity);
+	cloud->size = 0;
+}
+
+
+void urg_fusionSetScan(urg_fusion_t* fusion, int sensor,
+	const long data[], int n, long timestamp)
+{
+	urg_fusion_sensor_t& s = fusion->sensors[sensor];
+	if (n > s.state.max_size) {
+		n = s.state.max_size;
+	}
+
+	// A large step back is the counter wrapping, not an older scan
+	if ((s.latest >= 0) && (timestamp - s.last_timestamp < -TimestampRange / 2)) {
+		s.timestamp_wrap += TimestampRange;
+	}
+	s.last_timestamp = timestamp;
+
+	int next = (s.latest < 0) ? 0 : 1 - s.latest;
+	s.scans[next].timestamp = timestamp + s.timestamp_wrap;
+	s.scans[next].data.assign(data, data + n);
+	s.latest = next;
+}
+
+
+// Merge one sensor into its own region of the cloud
+static void mergeSensor(urg_fusion_sensor_t* sensor, int index,
+	long time, long max_age, urg_cloud_t* cloud)
+{
+	sensor->size = 0;
+	if (sensor->latest < 0) {
+		return;
+	}
+
+	// Scan nearest to the requested time
+	const urg_scan_t* scan = NULL;
+	long nearest_age = 0;
+	for (int i = 0; i < 2; ++i) {
+		const urg_scan_t& candidate = sensor->scans[i];
+		if (candidate.data.empty()) {
+			continue;
+		}
+		long age = labs(candidate.timestamp + sensor->mount.time_offset - time);
+		if (!scan || (age < nearest_age)) {
+			scan = &candidate;
+			nearest_age = age;
+		}
+	}
+	if (!scan || (nearest_age > max_age)) {
+		return;
+	}
+
+	const urg_state_t& state = sensor->state;
+	const long* data = &scan->data[0];
+	int n = (int)scan->data.size();
+	long scan_time = scan->timestamp + sensor->mount.time_offset;
+	float origin_x = (float)sensor->mount.x;
+	float origin_y = (float)sensor->mount.y;
+	const float* direction_x = &sensor->direction_x[0];
+	const float* direction_y = &sensor->direction_y[0];
+
+	float* x = &cloud->x[sensor->offset];
+	float* y = &cloud->y[sensor->offset];
+	long* timestamp = &cloud->timestamp[sensor->offset];
+	unsigned char* sensor_index = &cloud->sensor[sensor->offset];
+	size_t filled = 0;
+	for (int i = 0; i < n; ++i) {
+		long distance = data[i];
+		if ((distance < state.distance_min) || (distance > state.distance_max)) {
+			continue;
+		}
+		float d = (float)distance;
+		x[filled] = origin_x + d * direction_x[i];
+		y[filled] = origin_y + d * direction_y[i];
+		timestamp[filled] = scan_time + (long)((i - state.first) * sensor->step_time);
+		sensor_index[filled] = (unsigned char)index;
+		++filled;
+	}
+	sensor->size = filled;
+}
+
+
+size_t urg_fusionMerge(urg_fusion_t* fusion, long time, long max_age,
+	urg_cloud_t* cloud)
+{
+	int n = (int)fusion->sensors.size();
+	if (n > 0) {
+		// The cloud must be prepared after the last sensor was registered
+		const urg_fusion_sensor_t& last = fusion->sensors.back();
+		size_t capacity = last.offset + last.state.max_size;
+		if ((cloud->x.size() < capacity) || (cloud->y.size() < capacity) ||
+			(cloud->timestamp.size() < capacity) || (cloud->sensor.size() < capacity)) {
+			cloud->size = 0;
+			return 0;
+		}
+	}
+
+	auto merge = [&](int i) {
+		mergeSensor(&fusion->sensors[i], i, time, max_age, cloud);
+	};
+	if (fusion->pool && (n > 1)) {
+		fusion->pool->parallelFor(n, merge);
+	}
+	else {
+		for (int i = 0; i < n; ++i) {
+			merge(i);
+		}
+	}
+
+	// Pack the regions so that the points are contiguous
+	size_t filled = 0;
+	for (int i = 0; i < n; ++i) {
+		const urg_fusion_sensor_t& sensor = fusion->sensors[i];
+		if (sensor.offset != filled) {
+			size_t first = sensor.offset;
+			size_t last = sensor.offset + sensor.size;
+			copy(cloud->x.begin() + first, cloud->x.begin() + last, cloud->x.begin() + filled);
+			copy(cloud->y.begin() + first, cloud->y.begin() + last, cloud->y.begin() + filled);
+			copy(cloud->timestamp.begin() + first, cloud->timestamp.begin() + last,
+				cloud->timestamp.begin() + filled);
+			copy(cloud->sensor.begin() + first, cloud->sensor.begin() + last,
+				cloud->sensor.begin() + filled);
+		}
+		filled += sensor.size;
+	}
+	cloud->size = filled;
+
+	return filled;
+}
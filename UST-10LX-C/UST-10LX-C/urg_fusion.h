@@ -0,0 +1,159 @@
+/*!
+\file
+\brief Fusion of the scans of several sensors into one point cloud
+
+Each sensor is registered with its mounting pose. The direction of every
+step is rotated into the vehicle frame once at registration, so merging a
+scan is one multiply-add per step. Sensors are merged in parallel into a
+point cloud allocated by urg_fusionPrepareCloud(), so that merging does
+not allocate memory.
+
+\code
+urg_fusion_t fusion;
+urg_fusionInit(&fusion, &pool);
+urg_fusionAddSensor(&fusion, &front_state, &front_mount);
+urg_fusionAddSensor(&fusion, &rear_state, &rear_mount);
+urg_cloud_t cloud;
+urg_fusionPrepareCloud(&fusion, &cloud);
+
+// For each received scan
+urg_fusionSetScan(&fusion, sensor_index, data, n, timestamp);
+
+// For each planning cycle
+urg_fusionMerge(&fusion, now, 50, &cloud);
+\endcode
+*/
+
+#pragma once
+
+#include "urg_scan.h"
+#include <vector>
+
+class ThreadPool;
+
+
+/*!
+\brief Mounting of a sensor on the vehicle
+*/
+typedef struct
+{
+	double x;                     //!< Position of the sensor [mm]
+	double y;                     //!< Position of the sensor [mm]
+	double yaw;                   //!< Front direction of the sensor [radian]
+	long time_offset;             //!< Common time - sensor time stamp [msec]
+} urg_mount_t;
+
+
+/*!
+\brief Merged point cloud (structure of arrays)
+
+The arrays are allocated by urg_fusionPrepareCloud(), only the first
+size elements are valid.
+*/
+typedef struct
+{
+	std::vector<float> x;                  //!< Position in vehicle frame [mm]
+	std::vector<float> y;                  //!< Position in vehicle frame [mm]
+	std::vector<long> timestamp;           //!< Measured time, common time [msec]
+	std::vector<unsigned char> sensor;     //!< Index of the sensor
+	size_t size;                           //!< number of points
+} urg_cloud_t;
+
+
+/*!
+\brief Sensor registered to the fusion
+*/
+typedef struct
+{
+	urg_state_t state;
+	urg_mount_t mount;
+	std::vector<float> direction_x;        //!< Step direction in vehicle frame
+	std::vector<float> direction_y;        //!< Step direction in vehicle frame
+	double step_time;                      //!< Time between steps [msec]
+	urg_scan_t scans[2];                   //!< Latest two scans, unwrapped time stamp
+	long last_timestamp;                   //!< Time stamp of the latest scan as received
+	long timestamp_wrap;                   //!< Added to unwrap the 24 bit time stamp
+	int latest;                            //!< Index of the latest scan, -1 if none
+	size_t offset;                         //!< First point in the cloud
+	size_t size;                           //!< number of merged points
+} urg_fusion_sensor_t;
+
+
+/*!
+\brief Fusion of several sensors
+*/
+typedef struct
+{
+	std::vector<urg_fusion_sensor_t> sensors;
+	ThreadPool* pool;                      //!< NULL to merge in the calling thread
+} urg_fusion_t;
+
+
+/*!
+\brief Initialize
+
+\param fusion [o] Fusion
+\param pool [i] Thread pool to merge sensors in parallel, or NULL
+*/
+void urg_fusionInit(urg_fusion_t* fusion, ThreadPool* pool);
+
+
+/*!
+\brief Register a sensor
+
+\param fusion [i/o] Fusion
+\param state [i] Sensor information
+\param mount [i] Mounting of the sensor
+
+\retval >= 0 Index of the sensor
+\retval < 0 Error
+*/
+int urg_fusionAddSensor(urg_fusion_t* fusion,
+	const urg_state_t* state, const urg_mount_t* mount);
+
+
+/*!
+\brief Allocate the point cloud for all registered sensors
+
+\param fusion [i] Fusion
+\param cloud [o] Point cloud
+*/
+void urg_fusionPrepareCloud(const urg_fusion_t* fusion, urg_cloud_t* cloud);
+
+
+/*!
+\brief Store a scan of a sensor
+
+Scans of different sensors may be stored from different threads, but not
+while urg_fusionMerge() is running.
+
+\param fusion [i/o] Fusion
+\param sensor [i] Index of the sensor
+\param data [i] range data, as urg_receiveData()
+\param n [i] number of range data
+\param timestamp [i] Time stamp of the scan (sensor time) [msec]
+
+The sensor time stamp is a 24 bit counter which wraps about every 4.66
+hours. It is unwrapped here, so time_offset stays valid over the wrap.
+*/
+void urg_fusionSetScan(urg_fusion_t* fusion, int sensor,
+	const long data[], int n, long timestamp);
+
+
+/*!
+\brief Merge the scans of all sensors
+
+For each sensor, the stored scan nearest to time is used. Each point is
+stamped with its own measured time, calculated from the scan time stamp
+and the scan speed, so that the consumer can compensate the motion.
+
+\param fusion [i/o] Fusion
+\param time [i] Common time to align to [msec]
+\param max_age [i] Scans farther than this from time are not used [msec]
+\param cloud [o] Point cloud prepared by urg_fusionPrepareCloud()
+
+\retval number of merged points, 0 if the cloud was prepared before the
+last sensor was registered
+*/
+size_t urg_fusionMerge(urg_fusion_t* fusion, long time, long max_age,
+	urg_cloud_t* cloud);
@@ -0,0 +1,380 @@
+/*!
+\file
+\brief Occupancy grid built from the scans
+*/
+
+#include "stdafx.h"
+
+#include "urg_grid.h"
+#include "thread_pool.h"
+#include <cmath>
+#include <cstdlib>
+
+using namespace std;
+
+
+namespace
+{
+	const int TileShift = 6;
+	static_assert((1 << TileShift) == UrgGridTileSize, "TileShift does not match UrgGridTileSize");
+	const int TileMask = UrgGridTileSize - 1;
+
+
+	short toFixed(double log_odds)
+	{
+		double value = log_odds * UrgLogOddsScale;
+		value = (value < 0.0) ? value - 0.5 : value + 0.5;
+		if (value > 32767.0) {
+			value = 32767.0;
+		}
+		else if (value < -32768.0) {
+			value = -32768.0;
+		}
+		return (short)value;
+	}
+
+
+	// Index of the cell, tiles being stored one after another
+	inline int cellIndex(int tiles_x, int cx, int cy)
+	{
+		int tile = (cy >> TileShift) * tiles_x + (cx >> TileShift);
+		return (tile << (2 * TileShift)) + ((cy & TileMask) << TileShift) + (cx & TileMask);
+	}
+}
+
+
+void urg_gridDefaultConfig(urg_grid_config_t* config)
+{
+	config->resolution = 50.0;
+	config->origin_x = -20000.0;
+	config->origin_y = -20000.0;
+	config->width = 40000.0;
+	config->height = 40000.0;
+	config->max_range = 10000.0;
+	config->hit = 0.85;
+	config->miss = -0.4;
+	config->min_log_odds = -2.0;
+	config->max_log_odds = 3.5;
+}
+
+
+int urg_gridInit(urg_grid_t* grid, const urg_grid_config_t* config,
+	ThreadPool* pool)
+{
+	if ((config->resolution <= 0.0) || (config->width <= 0.0) ||
+		(config->height <= 0.0) || (config->max_range <= 0.0)) {
+		return -1;
+	}
+
+	grid->config = *config;
+	grid->pool = pool;
+	double tile_length = config->resolution * UrgGridTileSize;
+	grid->tiles_x = (int)ceil(config->width / tile_length);
+	grid->tiles_y = (int)ceil(config->height / tile_length);
+	grid->width = grid->tiles_x * UrgGridTileSize;
+	grid->height = grid->tiles_y * UrgGridTileSize;
+
+	int tiles = grid->tiles_x * grid->tiles_y;
+	grid->cells.assign((size_t)tiles * UrgGridTileSize * UrgGridTileSize, 0);
+	grid->tile_sequence.assign(tiles, 0);
+	grid->cell_sequence.assign(grid->cells.size(), 0);
+	grid->hit_sequence.assign(grid->cells.size(), 0);
+	grid->sequence = 0;
+
+	grid->hit = toFixed(config->hit);
+	grid->miss = toFixed(config->miss);
+	grid->min_value = toFixed(config->min_log_odds);
+	grid->max_value = toFixed(config->max_log_odds);
+
+	// The sector test needs sectors narrower than 180 degrees, which is
+	// the case from 4 sectors on
+	int sectors = 1;
+	if (pool) {
+		sectors = pool->size() * 2;
+		if (sectors < 4) {
+			sectors = 4;
+		}
+	}
+	grid->sectors.resize(sectors);
+	for (int i = 0; i < sectors; ++i) {
+		grid->sectors[i].touched.clear();
+		grid->sectors[i].touched.reserve(tiles);
+		grid->sectors[i].is_touched.assign(tiles, 0);
+	}
+
+	grid->sensors.clear();
+	grid->hits.clear();
+
+	return 0;
+}
+
+
+int urg_gridAddSensor(urg_grid_t* grid, const urg_state_t* state)
+{
+	if ((state->max_size <= 0) || (state->area_total <= 0)) {
+		return -1;
+	}
+
+	grid->sensors.push_back(urg_grid_sensor_t());
+	urg_grid_sensor_t& sensor = grid->sensors.back();
+	sensor.state = *state;
+	urg_makeDirections(state, &sensor.directions);
+
+	if ((int)grid->hits.size() < state->max_size) {
+		grid->hits.resize(state->max_size);
+	}
+	return (int)grid->sensors.size() - 1;
+}
+
+
+// Cast the rays of one sector. Only the cells of the sector are written
+static void castSector(urg_grid_t* grid, const urg_grid_sensor_t* sensor,
+	urg_grid_sector_t* sector, const long data[], const urg_pose_t* pose,
+	double sx, double sy)
+{
+	const urg_state_t& state = sensor->state;
+	const double inverse = 1.0 / grid->config.resolution;
+	const double max_range = grid->config.max_range;
+	const bool check_owner = grid->sectors.size() > 1;
+	const double c = cos(pose->theta);
+	const double s = sin(pose->theta);
+	const int tiles_x = grid->tiles_x;
+	short* cells = &grid->cells[0];
+	unsigned long* cell_sequence = &grid->cell_sequence[0];
+	const unsigned long sequence = grid->sequence;
+	int last_tile = -1;
+
+	for (int i = sector->first; i < sector->last; ++i) {
+		grid->hits[i] = -1;
+		long distance = data[i];
+		if (distance < state.distance_min) {
+			continue;
+		}
+
+		// No echo within range: the ray is free up to max_range
+		bool is_hit = (distance <= state.distance_max) && (distance <= max_range);
+		double length = (is_hit ? distance : max_range) * inverse;
+		double wx = c * sensor->directions.cos_table[i] - s * sensor->directions.sin_table[i];
+		double wy = s * sensor->directions.cos_table[i] + c * sensor->directions.sin_table[i];
+		double ex = sx + length * wx;
+		double ey = sy + length * wy;
+
+		// Traverse the cells from the sensor to the end of the ray
+		int cx = (int)sx;
+		int cy = (int)sy;
+		int tx = (int)floor(ex);
+		int ty = (int)floor(ey);
+		double dx = ex - sx;
+		double dy = ey - sy;
+		int step_x = (dx >= 0.0) ? 1 : -1;
+		int step_y = (dy >= 0.0) ? 1 : -1;
+		const double Far = 1e30;
+		double t_delta_x = (dx != 0.0) ? fabs(1.0 / dx) : Far;
+		double t_delta_y = (dy != 0.0) ? fabs(1.0 / dy) : Far;
+		double t_max_x = (dx > 0.0) ? (cx + 1 - sx) / dx : (dx < 0.0) ? (sx - cx) / -dx : Far;
+		double t_max_y = (dy > 0.0) ? (cy + 1 - sy) / dy : (dy < 0.0) ? (sy - cy) / -dy : Far;
+		int steps = abs(tx - cx) + abs(ty - cy);
+
+		for (int j = 0; j <= steps; ++j) {
+			if ((cx < 0) || (cy < 0) || (cx >= grid->width) || (cy >= grid->height)) {
+				break;
+			}
+			int index = cellIndex(tiles_x, cx, cy);
+			if ((j == steps) && is_hit) {
+				// Occupied cells are updated after all sectors
+				grid->hits[i] = index;
+				break;
+			}
+
+			bool is_owner = true;
+			if (check_owner) {
+				double vx = cx + 0.5 - sx;
+				double vy = cy + 0.5 - sy;
+				is_owner = (sector->begin_x * vy - sector->begin_y * vx >= 0.0) &&
+					(sector->end_x * vy - sector->end_y * vx < 0.0);
+			}
+			if (!is_owner) {
+				// The owner may not cross this cell with its own rays
+				sector->foreign.push_back(index);
+			}
+			else if (cell_sequence[index] != sequence) {
+				// A cell crossed by several rays is updated once per scan,
+				// so that the map does not depend on the sectors
+				cell_sequence[index] = sequence;
+				short value = cells[index] + grid->miss;
+				cells[index] = (value < grid->min_value) ? grid->min_value : value;
+
+				int tile = index >> (2 * TileShift);
+				if ((tile != last_tile) && !sector->is_touched[tile]) {
+					sector->is_touched[tile] = 1;
+					sector->touched.push_back(tile);
+				}
+				last_tile = tile;
+			}
+
+			if (t_max_x < t_max_y) {
+				cx += step_x;
+				t_max_x += t_delta_x;
+			}
+			else {
+				cy += step_y;
+				t_max_y += t_delta_y;
+			}
+		}
+	}
+}
+
+
+int urg_gridUpdate(urg_grid_t* grid, int sensor_index, const long data[],
+	int n, const urg_pose_t* pose)
+{
+	const urg_grid_sensor_t& sensor = grid->sensors[sensor_index];
+	const urg_state_t& state = sensor.state;
+	const double inverse = 1.0 / grid->config.resolution;
+
+	// Sensor position in cells
+	double sx = (pose->x - grid->config.origin_x) * inverse;
+	double sy = (pose->y - grid->config.origin_y) * inverse;
+	if ((sx < 0.0) || (sy < 0.0) || (sx >= grid->width) || (sy >= grid->height)) {
+		return -1;
+	}
+	++grid->sequence;
+
+	int first = (state.first > 0) ? state.first : 0;
+	int last = state.last + 1;
+	if (last > n) {
+		last = n;
+	}
+	if (last > state.max_size) {
+		last = state.max_size;
+	}
+	if (first >= last) {
+		return 0;
+	}
+
+	// Sectors and their boundaries in the world frame. The first and the
+	// last sector are extended to the back, so every cell has one owner
+	const double c = cos(pose->theta);
+	const double s = sin(pose->theta);
+	const double* cos_table = &sensor.directions.cos_table[0];
+	const double* sin_table = &sensor.directions.sin_table[0];
+	int sectors = (int)grid->sectors.size();
+	int count = last - first;
+	for (int k = 0; k < sectors; ++k) {
+		urg_grid_sector_t& sector = grid->sectors[k];
+		sector.first = first + (int)((long long)count * k / sectors);
+		sector.last = first + (int)((long long)count * (k + 1) / sectors);
+		if (k == 0) {
+			sector.begin_x = -c;
+			sector.begin_y = -s;
+		}
+		else {
+			// Between the last step of the previous sector and the first one
+			int i = sector.first;
+			if (i < 1) {
+				i = 1;
+			}
+			else if (i >= state.max_size) {
+				i = state.max_size - 1;
+			}
+			double x = cos_table[i - 1] + cos_table[i];
+			double y = sin_table[i - 1] + sin_table[i];
+			sector.begin_x = c * x - s * y;
+			sector.begin_y = s * x + c * y;
+			grid->sectors[k - 1].end_x = sector.begin_x;
+			grid->sectors[k - 1].end_y = sector.begin_y;
+		}
+	}
+	grid->sectors[sectors - 1].end_x = -c;
+	grid->sectors[sectors - 1].end_y = -s;
+
+	auto cast = [&](int k) {
+		castSector(grid, &sensor, &grid->sectors[k], data, pose, sx, sy);
+	};
+	if (grid->pool && (sectors > 1)) {
+		grid->pool->parallelFor(sectors, cast);
+	}
+	else {
+		for (int k = 0; k < sectors; ++k) {
+			cast(k);
+		}
+	}
+
+	// Cells crossed only by the rays of other sectors than their owner
+	short* cells = &grid->cells[0];
+	for (int k = 0; k < sectors; ++k) {
+		urg_grid_sector_t& sector = grid->sectors[k];
+		for (size_t i = 0; i < sector.foreign.size(); ++i) {
+			int index = sector.foreign[i];
+			if (grid->cell_sequence[index] == grid->sequence) {
+				continue;
+			}
+			grid->cell_sequence[index] = grid->sequence;
+			short value = cells[index] + grid->miss;
+			cells[index] = (value < grid->min_value) ? grid->min_value : value;
+			grid->tile_sequence[index >> (2 * TileShift)] = grid->sequence;
+		}
+		sector.foreign.clear();
+	}
+
+	// Occupied cells, after the free cells so that a hit is not cleared by
+	// a ray passing by in the same scan
+	for (int i = first; i < last; ++i) {
+		int index = grid->hits[i];
+		if ((index < 0) || (grid->hit_sequence[index] == grid->sequence)) {
+			continue;
+		}
+		// Rays ending in the same cell add one hit, as for the free cells
+		grid->hit_sequence[index] = grid->sequence;
+		short value = cells[index] + grid->hit;
+		cells[index] = (value > grid->max_value) ? grid->max_value : value;
+		grid->tile_sequence[index >> (2 * TileShift)] = grid->sequence;
+	}
+
+	for (int k = 0; k < sectors; ++k) {
+		urg_grid_sector_t& sector = grid->sectors[k];
+		for (size_t i = 0; i < sector.touched.size(); ++i) {
+			int tile = sector.touched[i];
+			grid->tile_sequence[tile] = grid->sequence;
+			sector.is_touched[tile] = 0;
+		}
+		sector.touched.clear();
+	}
+
+	return 0;
+}
+
+
+unsigned long urg_gridChangedTiles(const urg_grid_t* grid,
+	unsigned long since, std::vector<int>* tiles)
+{
+	tiles->clear();
+	int n = (int)grid->tile_sequence.size();
+	for (int i = 0; i < n; ++i) {
+		if (grid->tile_sequence[i] > since) {
+			tiles->push_back(i);
+		}
+	}
+	return grid->sequence;
+}
+
+
+const short* urg_gridTile(const urg_grid_t* grid, int tile)
+{
+	return &grid->cells[(size_t)tile << (2 * TileShift)];
+}
+
+
+double urg_gridProbability(const urg_grid_t* grid, double x, double y)
+{
+	const double inverse = 1.0 / grid->config.resolution;
+	double fx = (x - grid->config.origin_x) * inverse;
+	double fy = (y - grid->config.origin_y) * inverse;
+	if ((fx < 0.0) || (fy < 0.0) || (fx >= grid->width) || (fy >= grid->height)) {
+		return 0.5;
+	}
+
+	short value = grid->cells[cellIndex(grid->tiles_x, (int)fx, (int)fy)];
+	double log_odds = (double)value / UrgLogOddsScale;
+	return 1.0 - 1.0 / (1.0 + exp(log_odds));
+}
@@ -0,0 +1,202 @@
+/*!
+\file
+\brief Occupancy grid built from the scans
+
+The grid holds log odds in tiles of UrgGridTileSize x UrgGridTileSize
+cells, each tile being contiguous in memory. A scan is cast ray by ray:
+the cells on a ray are updated as free, and the cell at its end as
+occupied. A cell is updated as free at most once and as occupied at
+most once per scan, however many rays cross it or end in it.
+
+The rays are split into angular sectors, which are cast in parallel. A
+cell belongs to the sector containing its center, seen from the sensor,
+and a sector only updates its own cells, so no lock is needed. Cells
+crossed only by the rays of other sectors than their owner, and the
+occupied cells, are updated after all sectors, so that the map is the
+same whatever the number of sectors.
+
+Each tile records the update in which it was last changed, so that a
+consumer can fetch only the tiles changed since its last fetch.
+
+\code
+urg_grid_config_t config;
+urg_gridDefaultConfig(&config);
+urg_grid_t grid;
+urg_gridInit(&grid, &config, &pool);
+int front = urg_gridAddSensor(&grid, &urg_state);
+
+// For each received scan
+urg_gridUpdate(&grid, front, data, n, &pose);
+
+// Consumer
+std::vector<int> tiles;
+last_sequence = urg_gridChangedTiles(&grid, last_sequence, &tiles);
+\endcode
+*/
+
+#pragma once
+
+#include "urg_scan.h"
+#include <vector>
+
+class ThreadPool;
+
+
+enum {
+	UrgGridTileSize = 64,         //!< Cells on a side of a tile
+	UrgLogOddsScale = 256,        //!< Stored value of log odds 1.0
+};
+
+
+/*!
+\brief Parameters of the occupancy grid
+*/
+typedef struct
+{
+	double resolution;            //!< Cell size [mm]
+	double origin_x;              //!< World position of the grid corner [mm]
+	double origin_y;
+	double width;                 //!< Mapped area [mm]
+	double height;
+	double max_range;             //!< Farther range data are cast up to here as free [mm]
+	double hit;                   //!< Log odds added to an occupied cell
+	double miss;                  //!< Log odds added to a free cell
+	double min_log_odds;          //!< Clamp so that a cell can change again
+	double max_log_odds;
+} urg_grid_config_t;
+
+
+/*!
+\brief Sensor registered to the grid
+*/
+typedef struct
+{
+	urg_state_t state;
+	urg_directions_t directions;
+} urg_grid_sensor_t;
+
+
+/*!
+\brief Work of one angular sector
+*/
+typedef struct
+{
+	int first;                             //!< First step
+	int last;                              //!< Last step + 1
+	double begin_x;                        //!< Direction of the sector start, world frame
+	double begin_y;
+	double end_x;                          //!< Direction of the sector end, world frame
+	double end_y;
+	std::vector<int> touched;              //!< Tiles changed in this update
+	std::vector<unsigned char> is_touched;
+	std::vector<int> foreign;              //!< Crossed cells of other sectors
+} urg_grid_sector_t;
+
+
+/*!
+\brief Occupancy grid
+*/
+typedef struct
+{
+	urg_grid_config_t config;
+	ThreadPool* pool;             //!< NULL to cast in the calling thread
+
+	int tiles_x;                  //!< number of tiles
+	int tiles_y;
+	int width;                    //!< number of cells
+	int height;
+	std::vector<short> cells;     //!< Log odds x UrgLogOddsScale, tile by tile
+	std::vector<unsigned long> tile_sequence;  //!< Update in which a tile was changed
+	std::vector<unsigned long> cell_sequence;  //!< Update in which a cell was updated as free
+	std::vector<unsigned long> hit_sequence;   //!< Update in which a cell was updated as occupied
+	unsigned long sequence;       //!< number of updates
+
+	short hit;
+	short miss;
+	short min_value;
+	short max_value;
+
+	std::vector<urg_grid_sensor_t> sensors;
+	std::vector<urg_grid_sector_t> sectors;
+	std::vector<int> hits;        //!< Occupied cell of each step, -1 if none
+} urg_grid_t;
+
+
+/*!
+\brief Default parameters, 50 mm cells on 40 m x 40 m around the origin
+*/
+void urg_gridDefaultConfig(urg_grid_config_t* config);
+
+
+/*!
+\brief Initialize
+
+All the cells are allocated here.
+
+\param grid [o] Occupancy grid
+\param config [i] Parameters
+\param pool [i] Thread pool to cast sectors in parallel, or NULL
+
+\retval 0 Success
+\retval < 0 Error
+*/
+int urg_gridInit(urg_grid_t* grid, const urg_grid_config_t* config,
+	ThreadPool* pool);
+
+
+/*!
+\brief Register a sensor
+
+\retval >= 0 Index of the sensor
+\retval < 0 Error
+*/
+int urg_gridAddSensor(urg_grid_t* grid, const urg_state_t* state);
+
+
+/*!
+\brief Cast a scan into the grid
+
+Updates are not thread safe with each other; scans of several sensors are
+cast one after another, each one in parallel.
+
+\param grid [i/o] Occupancy grid
+\param sensor [i] Index of the sensor
+\param data [i] range data, as urg_receiveData()
+\param n [i] number of range data
+\param pose [i] Pose of the sensor in the world [mm], [radian]
+
+\retval 0 Success
+\retval < 0 The sensor is out of the grid
+*/
+int urg_gridUpdate(urg_grid_t* grid, int sensor, const long data[], int n,
+	const urg_pose_t* pose);
+
+
+/*!
+\brief Tiles changed after an update
+
+\param grid [i] Occupancy grid
+\param since [i] Value returned by the previous call, 0 for all tiles
+\param tiles [o] Index of the changed tiles
+
+\retval Value to pass as since next time
+*/
+unsigned long urg_gridChangedTiles(const urg_grid_t* grid,
+	unsigned long since, std::vector<int>* tiles);
+
+
+/*!
+\brief Cells of a tile
+
+Cell (x, y) of the tile is at [y * UrgGridTileSize + x]. Tile t covers
+cells from ((t % tiles_x) * UrgGridTileSize, (t / tiles_x) * UrgGridTileSize).
+*/
+const short* urg_gridTile(const urg_grid_t* grid, int tile);
+
+
+/*!
+\brief Occupancy probability at a world position
+
+\retval 0.0 - 1.0, 0.5 if unknown or out of the grid
+*/
+double urg_gridProbability(const urg_grid_t* grid, double x, double y);
@@ -0,0 +1,542 @@
+/*!
+\file
+\brief Correlative scan matcher for odometry from consecutive scans
+*/
+
+#include "stdafx.h"
+
+#include "urg_matcher.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+
+using namespace std;
+
+
+namespace
+{
+	const double Pi = 3.14159265358979323846;
+
+	// Likelihood of the kernel edge is exp(-LogLikelihoodMin)
+	const double LogLikelihoodMin = 4.5;
+
+
+	double normalizeAngle(double radian)
+	{
+		while (radian > Pi) {
+			radian -= 2.0 * Pi;
+		}
+		while (radian <= -Pi) {
+			radian += 2.0 * Pi;
+		}
+		return radian;
+	}
+
+
+	bool greaterScore(const urg_candidate_t& a, const urg_candidate_t& b)
+	{
+		return a.score > b.score;
+	}
+}
+
+
+void urg_matcherDefaultConfig(urg_matcher_config_t* config)
+{
+	config->resolution = 30.0;
+	config->sigma = 50.0;
+	config->max_range = 10000.0;
+	config->linear_window = 300.0;
+	config->angular_window = 0.2;
+	config->min_score = 0.3;
+	config->submap_scans = 5;
+	config->keyframe_distance = 200.0;
+	config->keyframe_angle = 0.1;
+}
+
+
+int urg_matcherInit(urg_matcher_t* matcher, const urg_state_t* state,
+	const urg_matcher_config_t* config, ThreadPool* pool)
+{
+	if ((state->max_size <= 0) || (config->resolution <= 0.0) ||
+		(config->sigma <= 0.0) || (config->max_range <= config->resolution) ||
+		(config->submap_scans <= 0)) {
+		return -1;
+	}
+
+	matcher->config = *config;
+	matcher->state = *state;
+	matcher->pool = pool;
+	urg_makeDirections(state, &matcher->directions);
+
+	// Truncated Gaussian around a point, 255 at the point and 0 at the
+	// edge. The score is then proportional to the log likelihood
+	double r = config->resolution;
+	int radius = (int)ceil(config->sigma * sqrt(2.0 * LogLikelihoodMin) / r);
+	int kernel_size = 2 * radius + 1;
+	matcher->kernel_radius = radius;
+	matcher->log_likelihood_min = LogLikelihoodMin;
+	matcher->kernel.resize(kernel_size * kernel_size);
+	for (int j = -radius; j <= radius; ++j) {
+		for (int i = -radius; i <= radius; ++i) {
+			double d2 = (i * i + j * j) * r * r;
+			double log_likelihood = d2 / (2.0 * config->sigma * config->sigma);
+			double value = 255.0 * (1.0 - log_likelihood / LogLikelihoodMin);
+			matcher->kernel[(j + radius) * kernel_size + (i + radius)] =
+				(unsigned char)((value > 0.0) ? value + 0.5 : 0.0);
+		}
+	}
+
+	// Rotation step which moves the farthest point by one cell
+	matcher->angle_step = acos(1.0 - (r * r) / (2.0 * config->max_range * config->max_range));
+	matcher->angle_steps = (int)ceil(config->angular_window / matcher->angle_step);
+	matcher->window = (int)ceil(config->linear_window / r);
+	matcher->levels = 1;
+	while ((1 << (matcher->levels - 1)) < 2 * matcher->window + 1) {
+		++matcher->levels;
+	}
+
+	int rotations = 2 * matcher->angle_steps + 1;
+	matcher->cells.resize(rotations);
+	for (int i = 0; i < rotations; ++i) {
+		matcher->cells[i].reserve(state->max_size);
+	}
+	matcher->found.resize(rotations);
+	matcher->point_x.reserve(state->max_size);
+	matcher->point_y.reserve(state->max_size);
+
+	matcher->keyframes.clear();
+	matcher->keyframes.reserve(config->submap_scans);
+	matcher->next_keyframe = 0;
+	matcher->grids.resize(matcher->levels);
+	matcher->width = 0;
+	matcher->height = 0;
+	matcher->origin_x = 0.0;
+	matcher->origin_y = 0.0;
+
+	urg_pose_t zero = { 0.0, 0.0, 0.0 };
+	matcher->pose = zero;
+	matcher->previous_pose = zero;
+	matcher->keyframe_pose = zero;
+	matcher->scans = 0;
+
+	return 0;
+}
+
+
+// Valid range data as points, thinned out to about one per cell
+static void collectPoints(urg_matcher_t* matcher, const long data[], int n)
+{
+	const urg_state_t& state = matcher->state;
+	const double r = matcher->config.resolution;
+	long distance_max = state.distance_max;
+	if (distance_max > matcher->config.max_range) {
+		distance_max = (long)matcher->config.max_range;
+	}
+	if (n > state.max_size) {
+		n = state.max_size;
+	}
+
+	matcher->point_x.clear();
+	matcher->point_y.clear();
+	float last_x = 0.0f;
+	float last_y = 0.0f;
+	for (int i = 0; i < n; ++i) {
+		long distance = data[i];
+		if ((distance < state.distance_min) || (distance > distance_max)) {
+			continue;
+		}
+		float x = (float)(distance * matcher->directions.cos_table[i]);
+		float y = (float)(distance * matcher->directions.sin_table[i]);
+		if (!matcher->point_x.empty()) {
+			float dx = x - last_x;
+			float dy = y - last_y;
+			if (dx * dx + dy * dy < r * r) {
+				continue;
+			}
+		}
+		matcher->point_x.push_back(x);
+		matcher->point_y.push_back(y);
+		last_x = x;
+		last_y = y;
+	}
+}
+
+
+// Rasterize the submap and precompute the coarse grids
+static void rebuildGrids(urg_matcher_t* matcher)
+{
+	const double r = matcher->config.resolution;
+	float min_x = 0.0f;
+	float min_y = 0.0f;
+	float max_x = 0.0f;
+	float max_y = 0.0f;
+	bool first = true;
+	for (size_t k = 0; k < matcher->keyframes.size(); ++k) {
+		const urg_keyframe_t& key = matcher->keyframes[k];
+		for (size_t i = 0; i < key.x.size(); ++i) {
+			if (first) {
+				min_x = max_x = key.x[i];
+				min_y = max_y = key.y[i];
+				first = false;
+				continue;
+			}
+			min_x = min(min_x, key.x[i]);
+			max_x = max(max_x, key.x[i]);
+			min_y = min(min_y, key.y[i]);
+			max_y = max(max_y, key.y[i]);
+		}
+	}
+
+	// Margin so that neither the kernel nor a searched translation of a
+	// point inside the submap goes out of the grid
+	int pad = matcher->window + matcher->kernel_radius + 1;
+	int width = (int)ceil((max_x - min_x) / r) + 2 * pad + 1;
+	int height = (int)ceil((max_y - min_y) / r) + 2 * pad + 1;
+	matcher->width = width;
+	matcher->height = height;
+	matcher->origin_x = min_x - pad * r;
+	matcher->origin_y = min_y - pad * r;
+
+	vector<unsigned char>& grid = matcher->grids[0];
+	grid.assign(width * height, 0);
+	int radius = matcher->kernel_radius;
+	int kernel_size = 2 * radius + 1;
+	for (size_t k = 0; k < matcher->keyframes.size(); ++k) {
+		const urg_keyframe_t& key = matcher->keyframes[k];
+		for (size_t i = 0; i < key.x.size(); ++i) {
+			int cx = (int)floor((key.x[i] - matcher->origin_x) / r);
+			int cy = (int)floor((key.y[i] - matcher->origin_y) / r);
+			for (int j = 0; j < kernel_size; ++j) {
+				unsigned char* cell = &grid[(cy - radius + j) * width + (cx - radius)];
+				const unsigned char* kernel = &matcher->kernel[j * kernel_size];
+				for (int m = 0; m < kernel_size; ++m) {
+					cell[m] = max(cell[m], kernel[m]);
+				}
+			}
+		}
+	}
+
+	// grids[h] at (x, y) is the maximum of grids[h - 1] at (x, y),
+	// (x + s, y), (x, y + s), (x + s, y + s) where s = 2^(h - 1)
+	for (int h = 1; h < matcher->levels; ++h) {
+		int s = 1 << (h - 1);
+		const vector<unsigned char>& src = matcher->grids[h - 1];
+		vector<unsigned char>& dst = matcher->grids[h];
+		dst.resize(width * height);
+		for (int y = 0; y < height; ++y) {
+			const unsigned char* row0 = &src[y * width];
+			unsigned char* out = &dst[y * width];
+			if (y + s < height) {
+				const unsigned char* row1 = &src[(y + s) * width];
+				for (int x = 0; x < width; ++x) {
+					out[x] = max(row0[x], row1[x]);
+				}
+			}
+			else {
+				copy(row0, row0 + width, out);
+			}
+			for (int x = 0; x + s < width; ++x) {
+				out[x] = max(out[x], out[x + s]);
+			}
+		}
+	}
+}
+
+
+static void addKeyframe(urg_matcher_t* matcher)
+{
+	if ((int)matcher->keyframes.size() < matcher->config.submap_scans) {
+		matcher->keyframes.push_back(urg_keyframe_t());
+	}
+	urg_keyframe_t& key = matcher->keyframes[matcher->next_keyframe];
+	matcher->next_keyframe = (matcher->next_keyframe + 1) % matcher->config.submap_scans;
+
+	const urg_pose_t& pose = matcher->pose;
+	double c = cos(pose.theta);
+	double s = sin(pose.theta);
+	size_t n = matcher->point_x.size();
+	key.pose = pose;
+	key.x.resize(n);
+	key.y.resize(n);
+	for (size_t i = 0; i < n; ++i) {
+		double x = matcher->point_x[i];
+		double y = matcher->point_y[i];
+		key.x[i] = (float)(c * x - s * y + pose.x);
+		key.y[i] = (float)(s * x + c * y + pose.y);
+	}
+	matcher->keyframe_pose = pose;
+
+	rebuildGrids(matcher);
+}
+
+
+static int scoreAt(const unsigned char* grid, const int* cells, int n,
+	int offset)
+{
+	int score = 0;
+	for (int i = 0; i < n; ++i) {
+		score += grid[cells[i] + offset];
+	}
+	return score;
+}
+
+
+static void branchAndBound(const urg_matcher_t* matcher,
+	const int* cells, int n, int level, const urg_candidate_t& candidate,
+	atomic<int>* best_score, urg_candidate_t* found)
+{
+	if (level == 0) {
+		int current = best_score->load();
+		while ((candidate.score > current) &&
+			!best_score->compare_exchange_weak(current, candidate.score)) {
+		}
+		if (candidate.score > found->score) {
+			*found = candidate;
+		}
+		return;
+	}
+
+	// Split into 4 translations of the finer level
+	int half = 1 << (level - 1);
+	const unsigned char* grid = &matcher->grids[level - 1][0];
+	urg_candidate_t children[4];
+	int count = 0;
+	for (int j = 0; j < 2; ++j) {
+		for (int i = 0; i < 2; ++i) {
+			urg_candidate_t child;
+			child.dx = candidate.dx + i * half;
+			child.dy = candidate.dy + j * half;
+			if ((child.dx > matcher->window) || (child.dy > matcher->window)) {
+				continue;
+			}
+			child.score = scoreAt(grid, cells, n, child.dy * matcher->width + child.dx);
+			children[count++] = child;
+		}
+	}
+	sort(children, children + count, greaterScore);
+
+	// The score of a coarse level is an upper bound of its finer levels
+	for (int i = 0; i < count; ++i) {
+		if (children[i].score <= best_score->load()) {
+			break;
+		}
+		branchAndBound(matcher, cells, n, level - 1, children[i], best_score, found);
+	}
+}
+
+
+static void searchRotation(urg_matcher_t* matcher, int k,
+	const urg_pose_t& guess, atomic<int>* best_score)
+{
+	double theta = guess.theta + (k - matcher->angle_steps) * matcher->angle_step;
+	double c = cos(theta);
+	double s = sin(theta);
+	double inverse = 1.0 / matcher->config.resolution;
+	int window = matcher->window;
+	int width = matcher->width;
+
+	// Cells of the rotated points. Points which may go out of the grid
+	// within the window are out of the submap and are not used
+	vector<int>& cells = matcher->cells[k];
+	cells.clear();
+	size_t n = matcher->point_x.size();
+	for (size_t i = 0; i < n; ++i) {
+		double x = c * matcher->point_x[i] - s * matcher->point_y[i] + guess.x;
+		double y = s * matcher->point_x[i] + c * matcher->point_y[i] + guess.y;
+		int cx = (int)floor((x - matcher->origin_x) * inverse);
+		int cy = (int)floor((y - matcher->origin_y) * inverse);
+		if ((cx < window) || (cx >= width - window) ||
+			(cy < window) || (cy >= matcher->height - window)) {
+			continue;
+		}
+		cells.push_back(cy * width + cx);
+	}
+
+	urg_candidate_t& found = matcher->found[k];
+	found.dx = 0;
+	found.dy = 0;
+	found.score = -1;
+	if (cells.empty()) {
+		return;
+	}
+
+	// Translations of the coarsest level, best first
+	int top = matcher->levels - 1;
+	int step = 1 << top;
+	const unsigned char* grid = &matcher->grids[top][0];
+	urg_candidate_t candidates[64];
+	int count = 0;
+	for (int dy = -window; (dy <= window) && (count < 64); dy += step) {
+		for (int dx = -window; (dx <= window) && (count < 64); dx += step) {
+			urg_candidate_t& candidate = candidates[count++];
+			candidate.dx = dx;
+			candidate.dy = dy;
+			candidate.score = scoreAt(grid, &cells[0], (int)cells.size(), dy * width + dx);
+		}
+	}
+	sort(candidates, candidates + count, greaterScore);
+
+	for (int i = 0; i < count; ++i) {
+		if (candidates[i].score <= best_score->load()) {
+			break;
+		}
+		branchAndBound(matcher, &cells[0], (int)cells.size(), top,
+			candidates[i], best_score, &found);
+	}
+}
+
+
+// Covariance from the likelihood of the poses around the best one
+static void estimateCovariance(const urg_matcher_t* matcher, int best_k,
+	double covariance[9])
+{
+	const urg_candidate_t& best = matcher->found[best_k];
+	const double r = matcher->config.resolution;
+	const double scale = matcher->log_likelihood_min / 255.0;
+	const int rotations = (int)matcher->found.size();
+	const int around = 2;
+
+	double sum_w = 0.0;
+	double mean[3] = { 0.0, 0.0, 0.0 };
+	double moment[9] = { 0.0 };
+	for (int k = best_k - 1; k <= best_k + 1; ++k) {
+		if ((k < 0) || (k >= rotations) || matcher->cells[k].empty()) {
+			continue;
+		}
+		const vector<int>& cells = matcher->cells[k];
+		for (int dy = best.dy - around; dy <= best.dy + around; ++dy) {
+			for (int dx = best.dx - around; dx <= best.dx + around; ++dx) {
+				if ((abs(dx) > matcher->window) || (abs(dy) > matcher->window)) {
+					continue;
+				}
+				int score = scoreAt(&matcher->grids[0][0], &cells[0],
+					(int)cells.size(), dy * matcher->width + dx);
+				double w = exp((score - best.score) * scale);
+				double v[3] = {
+					(dx - best.dx) * r,
+					(dy - best.dy) * r,
+					(k - best_k) * matcher->angle_step,
+				};
+				sum_w += w;
+				for (int i = 0; i < 3; ++i) {
+					mean[i] += w * v[i];
+					for (int j = 0; j < 3; ++j) {
+						moment[i * 3 + j] += w * v[i] * v[j];
+					}
+				}
+			}
+		}
+	}
+
+	for (int i = 0; i < 3; ++i) {
+		mean[i] /= sum_w;
+	}
+	for (int i = 0; i < 3; ++i) {
+		for (int j = 0; j < 3; ++j) {
+			covariance[i * 3 + j] = moment[i * 3 + j] / sum_w - mean[i] * mean[j];
+		}
+	}
+
+	// The search can not resolve better than its step
+	covariance[0] += r * r / 12.0;
+	covariance[4] += r * r / 12.0;
+	covariance[8] += matcher->angle_step * matcher->angle_step / 12.0;
+}
+
+
+int urg_matcherUpdate(urg_matcher_t* matcher, const long data[], int n,
+	urg_match_t* match)
+{
+	collectPoints(matcher, data, n);
+	for (int i = 0; i < 9; ++i) {
+		match->covariance[i] = 0.0;
+	}
+	match->score = 0.0;
+	match->matched = 0;
+
+	if (matcher->scans++ == 0) {
+		if (matcher->point_x.empty()) {
+			matcher->scans = 0;
+			match->pose = matcher->pose;
+			return -1;
+		}
+		addKeyframe(matcher);
+		match->pose = matcher->pose;
+		return 0;
+	}
+
+	// Constant velocity prediction
+	const urg_pose_t& pose = matcher->pose;
+	const urg_pose_t& previous = matcher->previous_pose;
+	double pc = cos(previous.theta);
+	double ps = sin(previous.theta);
+	double dx = pose.x - previous.x;
+	double dy = pose.y - previous.y;
+	double motion_x = pc * dx + ps * dy;
+	double motion_y = -ps * dx + pc * dy;
+	double c = cos(pose.theta);
+	double s = sin(pose.theta);
+	urg_pose_t guess;
+	guess.x = pose.x + c * motion_x - s * motion_y;
+	guess.y = pose.y + s * motion_x + c * motion_y;
+	guess.theta = normalizeAngle(pose.theta + (pose.theta - previous.theta));
+
+	int points = (int)matcher->point_x.size();
+	atomic<int> best_score((int)(matcher->config.min_score * 255.0 * points) - 1);
+	int rotations = 2 * matcher->angle_steps + 1;
+	if (points > 0) {
+		auto search = [&](int k) {
+			searchRotation(matcher, k, guess, &best_score);
+		};
+		if (matcher->pool) {
+			matcher->pool->parallelFor(rotations, search);
+		}
+		else {
+			for (int k = 0; k < rotations; ++k) {
+				search(k);
+			}
+		}
+	}
+
+	int best_k = -1;
+	for (int k = 0; (points > 0) && (k < rotations); ++k) {
+		if ((matcher->found[k].score >= 0) &&
+			((best_k < 0) || (matcher->found[k].score > matcher->found[best_k].score))) {
+			best_k = k;
+		}
+	}
+
+	matcher->previous_pose = matcher->pose;
+	if (best_k < 0) {
+		// Not matched. Hold the last pose and forget the motion, so that
+		// the prediction does not run ahead while matching fails
+		const urg_matcher_config_t& config = matcher->config;
+		match->pose = matcher->pose;
+		match->covariance[0] = config.linear_window * config.linear_window / 3.0;
+		match->covariance[4] = config.linear_window * config.linear_window / 3.0;
+		match->covariance[8] = config.angular_window * config.angular_window / 3.0;
+		return 0;
+	}
+
+	const urg_candidate_t& best = matcher->found[best_k];
+	matcher->pose.x = guess.x + best.dx * matcher->config.resolution;
+	matcher->pose.y = guess.y + best.dy * matcher->config.resolution;
+	matcher->pose.theta = normalizeAngle(guess.theta +
+		(best_k - matcher->angle_steps) * matcher->angle_step);
+	estimateCovariance(matcher, best_k, match->covariance);
+	match->pose = matcher->pose;
+	match->score = best.score / (255.0 * points);
+	match->matched = 1;
+
+	// Add a key scan when moved enough from the last one
+	double kx = matcher->pose.x - matcher->keyframe_pose.x;
+	double ky = matcher->pose.y - matcher->keyframe_pose.y;
+	double ktheta = normalizeAngle(matcher->pose.theta - matcher->keyframe_pose.theta);
+	if ((kx * kx + ky * ky > matcher->config.keyframe_distance * matcher->config.keyframe_distance) ||
+		(fabs(ktheta) > matcher->config.keyframe_angle)) {
+		addKeyframe(matcher);
+	}
+
+	return 0;
+}
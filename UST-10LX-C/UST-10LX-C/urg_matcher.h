@@ -0,0 +1,166 @@
+/*!
+\file
+\brief Correlative scan matcher for odometry from consecutive scans
+
+Each scan is matched against a submap made of the latest key scans. The
+submap is rasterized into a likelihood grid, and coarser grids holding the
+maximum of 2^h x 2^h cells are precomputed from it, so that a branch and
+bound search can discard most of the translations at a coarse level. The
+candidate rotations are searched in parallel. The grids are rebuilt only
+when a new key scan is added, not for every scan.
+
+The time of a scan grows with the number of rotations searched, which is
+angular_window divided by the angle step of max_range at resolution, and
+with the number of scan points. Rebuilding the grids on a new key scan
+costs more than matching; no timing is given here, measure it on the
+target with the actual parameters.
+
+\code
+urg_matcher_config_t config;
+urg_matcherDefaultConfig(&config);
+urg_matcher_t matcher;
+urg_matcherInit(&matcher, &urg_state, &config, &pool);
+
+// For each received scan
+urg_match_t match;
+urg_matcherUpdate(&matcher, data, n, &match);
+\endcode
+*/
+
+#pragma once
+
+#include "urg_scan.h"
+#include <vector>
+
+class ThreadPool;
+
+
+/*!
+\brief Parameters of the scan matcher
+*/
+typedef struct
+{
+	double resolution;            //!< Cell size of the finest grid [mm]
+	double sigma;                 //!< Standard deviation of range error [mm]
+	double max_range;             //!< Farther range data are not used [mm]
+	double linear_window;         //!< Searched translation from prediction [mm]
+	double angular_window;        //!< Searched rotation from prediction [radian]
+	double min_score;             //!< Matches with lower score are rejected, 0.0 - 1.0
+	int submap_scans;             //!< number of key scans in the submap, 1 for scan to scan
+	double keyframe_distance;     //!< Movement to add a key scan [mm]
+	double keyframe_angle;        //!< Rotation to add a key scan [radian]
+} urg_matcher_config_t;
+
+
+/*!
+\brief Result of matching one scan
+*/
+typedef struct
+{
+	urg_pose_t pose;              //!< Pose of the sensor from the first scan
+	double covariance[9];         //!< Covariance of x, y, theta, row major
+	double score;                 //!< Mean likelihood of the scan points, 0.0 - 1.0
+	int matched;                  //!< 0 if not matched, pose is the last matched pose
+} urg_match_t;
+
+
+/*!
+\brief Scan in the submap
+*/
+typedef struct
+{
+	urg_pose_t pose;
+	std::vector<float> x;         //!< Points in the world frame [mm]
+	std::vector<float> y;
+} urg_keyframe_t;
+
+
+/*!
+\brief Best translation found for one rotation
+*/
+typedef struct
+{
+	int dx;                       //!< [cell]
+	int dy;                       //!< [cell]
+	int score;
+} urg_candidate_t;
+
+
+/*!
+\brief Scan matcher
+*/
+typedef struct
+{
+	urg_matcher_config_t config;
+	urg_state_t state;
+	ThreadPool* pool;             //!< NULL to search in the calling thread
+	urg_directions_t directions;
+
+	std::vector<unsigned char> kernel;     //!< Likelihood around a point
+	int kernel_radius;                     //!< [cell]
+	double log_likelihood_min;             //!< Log likelihood of score 0
+	double angle_step;                     //!< [radian]
+	int angle_steps;                       //!< Rotations on each side of the prediction
+	int window;                            //!< Searched translation [cell]
+	int levels;                            //!< number of grids
+
+	std::vector<urg_keyframe_t> keyframes;
+	int next_keyframe;
+	urg_pose_t keyframe_pose;
+
+	std::vector<std::vector<unsigned char> > grids;  //!< grids[h] has max of 2^h x 2^h cells
+	int width;
+	int height;
+	double origin_x;                       //!< World position of cell (0, 0) [mm]
+	double origin_y;
+
+	std::vector<float> point_x;            //!< Points of the scan, sensor frame [mm]
+	std::vector<float> point_y;
+	std::vector<std::vector<int> > cells;  //!< Cell index of the points for each rotation
+	std::vector<urg_candidate_t> found;    //!< Best candidate for each rotation
+
+	urg_pose_t pose;
+	urg_pose_t previous_pose;
+	long scans;
+} urg_matcher_t;
+
+
+/*!
+\brief Default parameters for 40 Hz scans
+*/
+void urg_matcherDefaultConfig(urg_matcher_config_t* config);
+
+
+/*!
+\brief Initialize
+
+\param matcher [o] Scan matcher
+\param state [i] Sensor information
+\param config [i] Parameters
+\param pool [i] Thread pool to search rotations in parallel, or NULL
+
+\retval 0 Success
+\retval < 0 Error
+*/
+int urg_matcherInit(urg_matcher_t* matcher, const urg_state_t* state,
+	const urg_matcher_config_t* config, ThreadPool* pool);
+
+
+/*!
+\brief Match a scan and update the pose
+
+The prediction is the previous pose moved by the previous motion. The
+covariance is estimated from the scores around the best pose. When the
+scan does not match, the last pose is held and the motion is reset, with
+the search window as covariance.
+
+\param matcher [i/o] Scan matcher
+\param data [i] range data, as urg_receiveData()
+\param n [i] number of range data
+\param match [o] Result
+
+\retval 0 Success
+\retval < 0 Error
+*/
+int urg_matcherUpdate(urg_matcher_t* matcher, const long data[], int n,
+	urg_match_t* match);
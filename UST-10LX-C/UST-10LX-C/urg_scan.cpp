@@ -0,0 +1,247 @@
+/*!
+\file
+\brief Sensor information and SCIP scan decoding
+*/
+
+#include "stdafx.h"
+
+#include "urg_scan.h"
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+
+// Decode 6bit data
+long urg_decode(const char data[], int data_byte)
+{
+	long value = 0;
+	for (int i = 0; i < data_byte; ++i) {
+		value <<= 6;
+		value &= ~0x3f;
+		value |= data[i] - 0x30;
+	}
+	return value;
+}
+
+
+int checkSum(const char buffer[], int size, char actual_sum)
+{
+	char expected_sum = 0x00;
+	int i;
+
+	for (i = 0; i < size; ++i) {
+		expected_sum += buffer[i];
+	}
+	expected_sum = (expected_sum & 0x3f) + 0x30;
+
+	return (expected_sum == actual_sum) ? 0 : -1;
+}
+
+
+const char* urg_memLine(const char* p, const char* end,
+	const char** line, int* line_length)
+{
+	const char* q = p;
+	while ((q < end) && (*q != '\n') && (*q != '\r')) {
+		++q;
+	}
+	*line = p;
+	*line_length = (int)(q - p);
+
+	// The recording is written in text mode, so LF may be stored as CR/LF
+	if ((q < end) && (*q == '\r')) {
+		++q;
+	}
+	if ((q < end) && (*q == '\n')) {
+		++q;
+	}
+	return q;
+}
+
+
+const char* urg_nextFrame(const char* p, const char* end)
+{
+	while (p < end) {
+		const char* line;
+		int line_length;
+		p = urg_memLine(p, end, &line, &line_length);
+		if (line_length == 0) {
+			return p;
+		}
+	}
+	return end;
+}
+
+
+int urg_parseParameters(urg_state_t* state, const char* frame, size_t size)
+{
+	static const char* tags[] = {
+		"MODL:", "DMIN:", "DMAX:", "ARES:", "AMIN:", "AMAX:", "AFRT:", "SCAN:",
+	};
+	const int tag_size = sizeof(tags) / sizeof(tags[0]);
+	enum { BufferSize = 128 };
+	const char* end = frame + size;
+	const char* line;
+	int line_length;
+
+	const char* p = urg_memLine(frame, end, &line, &line_length);
+	if ((line_length < 2) || strncmp(line, "PP", 2)) {
+		return -1;
+	}
+
+	int found = 0;
+	while (p < end) {
+		p = urg_memLine(p, end, &line, &line_length);
+		if (line_length == 0) {
+			break;
+		}
+		if (line_length <= 5) {
+			continue;
+		}
+
+		// Copy the line since atoi() needs a terminated string
+		char buffer[BufferSize];
+		if (line_length >= BufferSize) {
+			line_length = BufferSize - 1;
+		}
+		memcpy(buffer, line, line_length);
+		buffer[line_length] = '\0';
+
+		for (int i = 0; i < tag_size; ++i) {
+			if (strncmp(buffer, tags[i], 5)) {
+				continue;
+			}
+			found |= 1 << i;
+			if (i == urg_state_t::MODL) {
+				buffer[line_length - 2] = '\0';
+				state->model = &buffer[5];
+			}
+			else if (i == urg_state_t::DMIN) {
+				state->distance_min = atoi(&buffer[5]);
+			}
+			else if (i == urg_state_t::DMAX) {
+				state->distance_max = atoi(&buffer[5]);
+			}
+			else if (i == urg_state_t::ARES) {
+				state->area_total = atoi(&buffer[5]);
+			}
+			else if (i == urg_state_t::AMIN) {
+				state->area_min = atoi(&buffer[5]);
+				state->first = state->area_min;
+			}
+			else if (i == urg_state_t::AMAX) {
+				state->area_max = atoi(&buffer[5]);
+				state->last = state->area_max;
+			}
+			else if (i == urg_state_t::AFRT) {
+				state->area_front = atoi(&buffer[5]);
+			}
+			else if (i == urg_state_t::SCAN) {
+				state->scan_rpm = atoi(&buffer[5]);
+			}
+			break;
+		}
+	}
+
+	if (found != (1 << tag_size) - 1) {
+		return -1;
+	}
+	state->max_size = state->area_max + 1;
+	state->last_timestamp = 0;
+
+	return 0;
+}
+
+
+int urg_decodeFrame(const urg_state_t* state,
+	const char* frame, size_t size, urg_scan_t* scan)
+{
+	const char* end = frame + size;
+	const char* line;
+	int line_length;
+
+	// Echo back. Only GD and MD responses have 3 byte range data
+	const char* p = urg_memLine(frame, end, &line, &line_length);
+	if ((line_length < 6) || (line[1] != 'D') ||
+		((line[0] != 'G') && (line[0] != 'M'))) {
+		return 0;
+	}
+	char message_type = line[0];
+	char first_str[5];
+	memcpy(first_str, &line[2], 4);
+	first_str[4] = '\0';
+	int first = atoi(first_str);
+
+	// Status. MD returns "00" as acknowledge and "99" with range data
+	p = urg_memLine(p, end, &line, &line_length);
+	if ((line_length < 2) ||
+		strncmp(line, (message_type == 'G') ? "00" : "99", 2)) {
+		return 0;
+	}
+
+	// Time stamp
+	p = urg_memLine(p, end, &line, &line_length);
+	if (line_length < 5) {
+		return -1;
+	}
+	if (checkSum(line, line_length - 1, line[line_length - 1]) < 0) {
+		return -1;
+	}
+	scan->timestamp = urg_decode(line, 4);
+
+	// Range data. A value may be split between two lines
+	const int data_byte = 3;
+	char remain_data[3];
+	int remain_byte = 0;
+	std::vector<long>& data = scan->data;
+	data.assign(first, -1);
+
+	while (p < end) {
+		p = urg_memLine(p, end, &line, &line_length);
+		if (line_length == 0) {
+			break;
+		}
+		if (checkSum(line, line_length - 1, line[line_length - 1]) < 0) {
+			return -1;
+		}
+
+		const char* q = line;
+		const char* q_end = line + line_length - 1;
+		while ((remain_byte > 0) && (q < q_end)) {
+			remain_data[remain_byte++] = *q++;
+			if (remain_byte == data_byte) {
+				data.push_back(urg_decode(remain_data, data_byte));
+				remain_byte = 0;
+			}
+		}
+		for (; q + data_byte <= q_end; q += data_byte) {
+			data.push_back(urg_decode(q, data_byte));
+		}
+		while (q < q_end) {
+			remain_data[remain_byte++] = *q++;
+		}
+	}
+
+	// fill -1 to last of data buffer
+	if (static_cast<int>(data.size()) < state->max_size) {
+		data.resize(state->max_size, -1);
+	}
+	return (int)data.size();
+}
+
+
+void urg_makeDirections(const urg_state_t* state,
+	urg_directions_t* directions)
+{
+	const double pi = 3.14159265358979323846;
+	int n = state->max_size;
+
+	directions->cos_table.resize(n);
+	directions->sin_table.resize(n);
+	for (int i = 0; i < n; ++i) {
+		double radian =
+			(i - state->area_front) * 2.0 * pi / state->area_total;
+		directions->cos_table[i] = cos(radian);
+		directions->sin_table[i] = sin(radian);
+	}
+}
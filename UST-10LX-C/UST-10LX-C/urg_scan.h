@@ -0,0 +1,154 @@
+/*!
+\file
+\brief Sensor information and SCIP scan decoding
+
+The functions in this file do not touch the COM port, so they can be used
+to decode recorded SCIP responses as well as live ones.
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+
+/*!
+\brief Manage sensor information
+*/
+typedef struct
+{
+	enum {
+		MODL = 0,                   //!< Sensor model information              0
+		DMIN,                       //!< Minimum measurable distance [mm]      1
+		DMAX,                       //!< Maximum measurable distance [mm]      2
+		ARES,                       //!< Angle of resolution                   3
+		AMIN,                       //!< Minimum measurable area               4
+		AMAX,                       //!< Maximum measurable area               5
+		AFRT,                       //!< Front direction value                 6
+		SCAN,                       //!< Standard angular velocity             7
+	};
+	std::string model;            //!< Obtained MODL information
+	long distance_min;            //!< Obtained DMIN information
+	long distance_max;            //!< Obtained DMAX information
+	int area_total;               //!< Obtained ARES information
+	int area_min;                 //!< Obtained AMIN information
+	int area_max;                 //!< Obtained AMAX information
+	int area_front;               //!< Obtained AFRT information
+	int scan_rpm;                 //!< Obtained SCAN information
+
+	int first;                    //!< Starting position of measurement
+	int last;                     //!< End position of measurement
+	int max_size;                 //!< Maximum size of data
+	long last_timestamp;          //!< Time stamp when latest data is obtained
+} urg_state_t;
+
+
+/*!
+\brief Range data of one scan
+*/
+typedef struct
+{
+	long timestamp;               //!< Time stamp of the scan [msec]
+	std::vector<long> data;       //!< Range data from step 0 [mm], -1 if not measured
+} urg_scan_t;
+
+
+/*!
+\brief Direction vector of each step
+
+cos_table[i], sin_table[i] is the direction of step i, the front
+direction (AFRT) being the x axis.
+*/
+typedef struct
+{
+	std::vector<double> cos_table;
+	std::vector<double> sin_table;
+} urg_directions_t;
+
+
+/*!
+\brief Pose on the plane
+*/
+typedef struct
+{
+	double x;                     //!< [mm]
+	double y;                     //!< [mm]
+	double theta;                 //!< [radian]
+} urg_pose_t;
+
+
+// Decode 6bit data
+long urg_decode(const char data[], int data_byte);
+
+int checkSum(const char buffer[], int size, char actual_sum);
+
+
+/*!
+\brief Read one line from memory
+
+\param p [i] Start of the line
+\param end [i] End of the buffer
+\param line [o] Start of the line
+\param line_length [o] Length of the line without LF or CR/LF
+
+\retval Start of the next line
+*/
+const char* urg_memLine(const char* p, const char* end,
+	const char** line, int* line_length);
+
+
+/*!
+\brief Find the end of the response which starts at p
+
+A SCIP response is terminated by an empty line. Both LF and CR/LF line
+endings are accepted.
+
+\param p [i] Start of the response
+\param end [i] End of the buffer
+
+\retval Position just after the terminating empty line, or end
+*/
+const char* urg_nextFrame(const char* p, const char* end);
+
+
+/*!
+\brief Read sensor information from a recorded PP response
+
+\param state [o] Sensor information
+\param frame [i] PP response
+\param size [i] Size of the response
+
+\retval 0 Success
+\retval < 0 frame is not a PP response
+*/
+int urg_parseParameters(urg_state_t* state, const char* frame, size_t size);
+
+
+/*!
+\brief Decode a recorded GD / MD response
+
+The data is stored with the same layout as urg_receiveData(): steps before
+the starting position and after the end position are filled with -1.
+
+\param state [i] Sensor information
+\param frame [i] GD / MD response
+\param size [i] Size of the response
+\param scan [o] range data
+
+\retval > 0 number of range data
+\retval 0 frame has no range data (acknowledge or other command)
+\retval < 0 Error
+*/
+int urg_decodeFrame(const urg_state_t* state,
+	const char* frame, size_t size, urg_scan_t* scan);
+
+
+/*!
+\brief Calculate direction vector of each step
+
+\param state [i] Sensor information
+\param directions [o] Direction vectors of step 0 to max_size - 1
+*/
+void urg_makeDirections(const urg_state_t* state,
+	urg_directions_t* directions);